@@ -0,0 +1,156 @@
+/**
+ * idmap.c - Open-addressing hash map from (argument, uid/gid) to blocks.
+ *
+ * Keys are hashed with Fibonacci hashing and collisions are resolved by
+ * linear probing. A tree usually has a handful of owners, so the map
+ * stays small and in cache.
+ *
+ * Author: Rasmus Mikaelsson (et24rmn)
+ * Version: 12-01-2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "idmap.h"
+
+/* Initial number of slots */
+#define IDMAP_MIN_CAP 16
+
+/* ------------------ Declarations of internal functions ------------------ */
+
+static size_t slot_of(const IdMap *m, uint64_t key);
+static int grow(IdMap *m);
+static int add_key(IdMap *m, uint64_t key, blkcnt_t blocks);
+static int compare_usage(const void *a, const void *b);
+
+/* -------------------------- External functions -------------------------- */
+
+int idmap_add(IdMap *m, int root, uint32_t id, blkcnt_t blocks) {
+	return add_key(m, ((uint64_t)root << 32) | id, blocks);
+}
+
+int idmap_merge(IdMap *dst, const IdMap *src) {
+	for(size_t i = 0; i < src->cap; i++) {
+		if(src->keys[i] != IDMAP_EMPTY && add_key(dst, src->keys[i], src->blocks[i]) != 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+IdUsage *idmap_collect(const IdMap *m, int root, size_t *n) {
+	*n = 0;
+	if(m->len == 0) {
+		return NULL;
+	}
+
+	IdUsage *usage = malloc(m->len * sizeof(IdUsage));
+	if(!usage) {
+		perror("malloc");
+		return NULL;
+	}
+
+	for(size_t i = 0; i < m->cap; i++) {
+		if(m->keys[i] != IDMAP_EMPTY && (int)(m->keys[i] >> 32) == root) {
+			usage[(*n)++] = (IdUsage){ .id = (uint32_t)m->keys[i], .blocks = m->blocks[i] };
+		}
+	}
+	qsort(usage, *n, sizeof(IdUsage), compare_usage);
+	return usage;
+}
+
+void idmap_free(IdMap *m) {
+	if(!m) return;
+	free(m->keys);
+	free(m->blocks);
+	*m = (IdMap){ 0 };
+}
+
+/* -------------------------- Internal functions -------------------------- */
+
+/**
+ * slot_of - Finds the slot holding @key, or the empty slot where it belongs.
+ * @m: Pointer to map with at least one empty slot.
+ * @key: Key to look up.
+ *
+ * Return: Slot index.
+ */
+static size_t slot_of(const IdMap *m, uint64_t key) {
+	size_t mask = m->cap - 1;
+	size_t i = (size_t)((key * 0x9e3779b97f4a7c15ULL) >> 32) & mask;
+	while(m->keys[i] != IDMAP_EMPTY && m->keys[i] != key) {
+		i = (i + 1) & mask;
+	}
+	return i;
+}
+
+/**
+ * grow - Doubles the number of slots and rehashes every key.
+ * @m: Pointer to map.
+ *
+ * Return: 0 on success, -1 on failure.
+ */
+static int grow(IdMap *m) {
+	IdMap bigger = { .cap = m->cap ? m->cap * 2 : IDMAP_MIN_CAP };
+	bigger.keys = malloc(bigger.cap * sizeof(uint64_t));
+	bigger.blocks = malloc(bigger.cap * sizeof(blkcnt_t));
+	if(!bigger.keys || !bigger.blocks) {
+		perror("malloc");
+		idmap_free(&bigger);
+		return -1;
+	}
+	for(size_t i = 0; i < bigger.cap; i++) {
+		bigger.keys[i] = IDMAP_EMPTY;
+	}
+
+	for(size_t i = 0; i < m->cap; i++) {
+		if(m->keys[i] != IDMAP_EMPTY) {
+			size_t j = slot_of(&bigger, m->keys[i]);
+			bigger.keys[j] = m->keys[i];
+			bigger.blocks[j] = m->blocks[i];
+		}
+	}
+	bigger.len = m->len;
+
+	idmap_free(m);
+	*m = bigger;
+	return 0;
+}
+
+/**
+ * add_key - Adds blocks to a key, inserting it if needed.
+ * @m: Pointer to map.
+ * @key: Key to add to.
+ * @blocks: Blocks to add.
+ *
+ * The map grows at 3/4 load so probe sequences stay short.
+ *
+ * Return: 0 on success, -1 on failure.
+ */
+static int add_key(IdMap *m, uint64_t key, blkcnt_t blocks) {
+	if((m->len + 1) * 4 > m->cap * 3 && grow(m) != 0) {
+		return -1;
+	}
+
+	size_t i = slot_of(m, key);
+	if(m->keys[i] == IDMAP_EMPTY) {
+		m->keys[i] = key;
+		m->blocks[i] = 0;
+		m->len++;
+	}
+	m->blocks[i] += blocks;
+	return 0;
+}
+
+/**
+ * compare_usage - qsort comparator, largest block count first.
+ * @a: First IdUsage.
+ * @b: Second IdUsage.
+ *
+ * Return: Negative, zero or positive like strcmp.
+ */
+static int compare_usage(const void *a, const void *b) {
+	blkcnt_t x = ((const IdUsage *)a)->blocks;
+	blkcnt_t y = ((const IdUsage *)b)->blocks;
+	return (x < y) - (x > y);
+}
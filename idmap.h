@@ -0,0 +1,80 @@
+/**
+ * idmap.h - Open-addressing hash map from (argument, uid/gid) to blocks.
+ *
+ * Each worker owns one map per accounting kind, so adding to it needs no
+ * locking. The maps are merged once all workers have been joined.
+ *
+ * Author: Rasmus Mikaelsson (et24rmn)
+ * Version: 12-01-2026
+ */
+
+#ifndef IDMAP_H
+#define IDMAP_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * struct IdMap - Hash map with linear probing.
+ * @keys: Argument index in the high and id in the low 32 bits, IDMAP_EMPTY if unused.
+ * @blocks: Block count of each key.
+ * @cap: Number of slots, a power of two or 0.
+ * @len: Number of used slots.
+ */
+typedef struct IdMap {
+    uint64_t *keys;
+    blkcnt_t *blocks;
+    size_t cap;
+    size_t len;
+} IdMap;
+
+#define IDMAP_EMPTY UINT64_MAX
+
+/**
+ * struct IdUsage - One entry of a map, as returned by idmap_collect().
+ * @id: User or group id.
+ * @blocks: Blocks owned by @id.
+ */
+typedef struct IdUsage {
+    uint32_t id;
+    blkcnt_t blocks;
+} IdUsage;
+
+/**
+ * Adds blocks to an id of an argument.
+ *
+ * @param m			Pointer to map, zero-initialized before first use
+ * @param root		Index of the argument
+ * @param id		User or group id
+ * @param blocks	Blocks to add
+ * @return			0 on success, -1 on failure
+ */
+int idmap_add(IdMap *m, int root, uint32_t id, blkcnt_t blocks);
+
+/**
+ * Adds every entry of src to dst.
+ *
+ * @param dst	Map to add to
+ * @param src	Map to add from
+ * @return		0 on success, -1 on failure
+ */
+int idmap_merge(IdMap *dst, const IdMap *src);
+
+/**
+ * Collects the ids of one argument, largest usage first.
+ *
+ * @param m		Pointer to map
+ * @param root	Index of the argument
+ * @param n		Set to the number of returned entries
+ * @return		Array of entries to be freed by the caller, NULL on failure or if empty
+ */
+IdUsage *idmap_collect(const IdMap *m, int root, size_t *n);
+
+/**
+ * Frees the map's memory and resets it to empty.
+ *
+ * @param m		Pointer to map
+ */
+void idmap_free(IdMap *m);
+
+#endif
@@ -14,41 +14,105 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <pwd.h>
+#include <grp.h>
+#include <math.h>
 #include <linux/limits.h>
 #include "string.h"
 #include "system.h"
+#include "monitor.h"
+#include "worker.h"
+#include "shard.h"
+#include "ratelimit.h"
+#include "snapshot.h"
+
+#define USAGE "Usage: %s [-j n_threads] [--estimate[=probes]] [--estimate-time seconds]\n" \
+              "       [--progress[=seconds]] [--deadline seconds] [--inode-order]\n" \
+              "       [--procs n_processes] [--by-user] [--by-group]\n" \
+              "       [--histogram[=size,atime,mtime]] [--max-iops n] [--max-dirs-per-sec n]\n" \
+              "       [--idle-io] [--max-queue-mem bytes[K|M|G]] [--largest-first]\n" \
+              "       [--save snapshot] [--diff snapshot] file ...\n"
+
+/* Default number of probes per argument in estimate mode */
+#define DEFAULT_PROBES 1000
+
+/**
+ * struct Report - Optional breakdowns printed below each total.
+ * @users: Merged usage by owner, NULL if not requested.
+ * @groups: Merged usage by group, NULL if not requested.
+ * @hist: Merged histograms, NULL if not requested.
+ * @hist_kinds: Bit mask of the histograms in @hist.
+ */
+typedef struct Report {
+    const IdMap *users;
+    const IdMap *groups;
+    const HistBucket *hist;
+    int hist_kinds;
+} Report;
+
+/* Seconds the main thread walks alone before starting the pool */
+#define SMALL_TREE_TIME 0.002
+
+/* Two-sided 95% quantile of the normal distribution */
+#define Z_95 1.96
+
+/* Directories listed per direction by --diff */
+#define DIFF_TOP 10
 
 /* ------------------ Declarations of internal functions ------------------ */
 
-static int parse_commandline(int argc, char **argv);
+static int parse_commandline(int argc, char **argv, Options *opts);
 static blkcnt_t *init_sums(int file_count);
-static int process_files(System *system, char **argv, int argc, int optind, pthread_t *threads, int n_threads);
-static int enqueue_tasks(System *system, char **argv, int argc, int optind, blkcnt_t *sums);
+static int process_files(System *system, char **argv, int argc, int optind, pthread_t *threads);
+static int create_tasks(System *system, char **argv, int argc, int optind, blkcnt_t *sums, TaskStack *stack);
+static int run_tasks(System *system, TaskStack *stack, pthread_t *threads);
+static int process_sharded(const Options *opts, char **argv, int argc, int optind);
+static int parse_histograms(const char *arg);
+static int parse_size(const char *arg, size_t *bytes);
+static void print_totals(blkcnt_t *sums, char **argv, int optind, int file_count, int expired,
+                         const Report *report);
+static void print_usage(const IdMap *map, int root, int by_group);
+static void print_histogram(const HistBucket *hist, int kind);
+static void format_bound(char *buf, size_t len, int kind, int bucket);
+static void print_estimates(System *system, char **argv, int optind, int file_count);
+static int process_snapshots(System *system, const Snapshot *old, int expired);
+static void print_diff(const Snapshot *old, const Snapshot *new, const char *file);
 
 /* -------------------------- External functions -------------------------- */
 
 int main(int argc, char **argv)
 {
     if (argc < 2) {
-        fprintf(stderr, "Usage: %s [-j n_threads] file ...\n", argv[0]);
+        fprintf(stderr, USAGE, argv[0]);
         exit(EXIT_FAILURE);
     }
 
-    int n_threads = parse_commandline(argc, argv);
-    if (n_threads < 0) {
+    Options opts;
+    if (parse_commandline(argc, argv, &opts) < 0) {
         exit(EXIT_FAILURE);
 	}
 
+    /* Threads and worker processes inherit the I/O class */
+    if (opts.idle_io && set_idle_io_priority() != 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    if (opts.procs > 0) {
+        return process_sharded(&opts, argv, argc, optind);
+    }
+
+    int n_threads = opts.n_threads;
     pthread_t threads[n_threads];
     System system;
 
-    /* Initialize system and threads */
-    if (system_init(&system, threads, n_threads) < 0) {
+    /* Initialize system, threads are started once there is work for them */
+    if (system_init(&system, &opts) < 0) {
         fprintf(stderr, "Initialization failed\n");
         exit(EXIT_FAILURE);
     }
 
-	if (process_files(&system, argv, argc, optind, threads, n_threads) != 0) {
+	if (process_files(&system, argv, argc, optind, threads) != 0) {
         system_destroy(&system);
         exit(EXIT_FAILURE);
     }
@@ -63,30 +127,155 @@ int main(int argc, char **argv)
 /* -------------------------- Internal functions -------------------------- */
 
 /**
- * parse_commandline - Parses -j flag and returns number of threads.
+ * parse_commandline - Parses command-line options into @opts.
  * @argc: Argument count.
  * @argv: Argument vector.
+ * @opts: Options to fill in.
  *
- * Return: Number of threads (>=1), or -1 on error.
+ * Return: 0 on success, or -1 on error.
  */
-static int parse_commandline(int argc, char **argv)
+static int parse_commandline(int argc, char **argv, Options *opts)
 {
+    static const struct option long_opts[] = {
+        { "estimate",      optional_argument, NULL, 'e' },
+        { "estimate-time", required_argument, NULL, 'E' },
+        { "progress",      optional_argument, NULL, 'p' },
+        { "deadline",      required_argument, NULL, 'd' },
+        { "inode-order",   no_argument,       NULL, 'i' },
+        { "procs",         required_argument, NULL, 'P' },
+        { "by-user",       no_argument,       NULL, 'u' },
+        { "by-group",      no_argument,       NULL, 'g' },
+        { "histogram",     optional_argument, NULL, 'H' },
+        { "max-iops",      required_argument, NULL, 'I' },
+        { "max-dirs-per-sec", required_argument, NULL, 'D' },
+        { "idle-io",       no_argument,       NULL, 'O' },
+        { "max-queue-mem", required_argument, NULL, 'M' },
+        { "largest-first", no_argument,       NULL, 'L' },
+        { "save",          required_argument, NULL, 'S' },
+        { "diff",          required_argument, NULL, 'F' },
+        { NULL, 0, NULL, 0 }
+    };
     int opt;
-    int n_threads = 1;
 
-    while ((opt = getopt(argc, argv, "j:")) != -1) {
+    opts->n_threads = 1;
+    opts->estimate = 0;
+    opts->estimate_probes = 0;
+    opts->estimate_time = 0;
+    opts->progress = 0;
+    opts->deadline = 0;
+    opts->inode_order = 0;
+    opts->procs = 0;
+    opts->by_user = 0;
+    opts->by_group = 0;
+    opts->histogram = 0;
+    opts->max_iops = 0;
+    opts->max_dirs_per_sec = 0;
+    opts->idle_io = 0;
+    opts->max_queue_mem = 0;
+    opts->largest_first = 0;
+    opts->save = NULL;
+    opts->diff = NULL;
+
+    while ((opt = getopt_long(argc, argv, "j:", long_opts, NULL)) != -1) {
         switch (opt) {
         case 'j':
             if (atoi(optarg) > 0)
-                n_threads = atoi(optarg);
+                opts->n_threads = atoi(optarg);
+            break;
+        case 'e':
+            opts->estimate = 1;
+            if (optarg && atol(optarg) > 0)
+                opts->estimate_probes = atol(optarg);
+            break;
+        case 'E':
+            opts->estimate = 1;
+            if (atof(optarg) > 0)
+                opts->estimate_time = atof(optarg);
+            break;
+        case 'p':
+            opts->progress = 1.0;
+            if (optarg && atof(optarg) > 0)
+                opts->progress = atof(optarg);
+            break;
+        case 'd':
+            if (atof(optarg) > 0)
+                opts->deadline = atof(optarg);
+            break;
+        case 'i':
+            opts->inode_order = 1;
+            break;
+        case 'P':
+            if (atoi(optarg) > 0)
+                opts->procs = atoi(optarg);
+            break;
+        case 'u':
+            opts->by_user = 1;
+            break;
+        case 'g':
+            opts->by_group = 1;
+            break;
+        case 'H':
+            opts->histogram = parse_histograms(optarg);
+            if (opts->histogram < 0) {
+                fprintf(stderr, USAGE, argv[0]);
+                return -1;
+            }
+            break;
+        case 'I':
+            if (atof(optarg) > 0)
+                opts->max_iops = atof(optarg);
+            break;
+        case 'D':
+            if (atof(optarg) > 0)
+                opts->max_dirs_per_sec = atof(optarg);
+            break;
+        case 'O':
+            opts->idle_io = 1;
+            break;
+        case 'L':
+            opts->largest_first = 1;
+            break;
+        case 'S':
+            opts->save = optarg;
+            break;
+        case 'F':
+            opts->diff = optarg;
+            break;
+        case 'M':
+            if (parse_size(optarg, &opts->max_queue_mem) != 0) {
+                fprintf(stderr, USAGE, argv[0]);
+                return -1;
+            }
             break;
         default:
-            fprintf(stderr, "Usage: %s [-j n_threads] file ...\n", argv[0]);
+            fprintf(stderr, USAGE, argv[0]);
             return -1;
         }
     }
 
-    return n_threads;
+    /* Estimates are bounded by a probe count, a time budget, or both */
+    if (opts->estimate && opts->estimate_probes == 0 && opts->estimate_time == 0) {
+        opts->estimate_probes = DEFAULT_PROBES;
+    }
+
+    if (optind >= argc) {
+        fprintf(stderr, USAGE, argv[0]);
+        return -1;
+    }
+
+    if (opts->procs > 0 && (opts->estimate || opts->progress > 0)) {
+        fprintf(stderr, "%s: --procs cannot be combined with --estimate or --progress\n", argv[0]);
+        return -1;
+    }
+
+    if ((opts->by_user || opts->by_group || opts->histogram || opts->save || opts->diff) &&
+        (opts->estimate || opts->procs > 0)) {
+        fprintf(stderr, "%s: --by-user, --by-group, --histogram, --save and --diff need a full scan "
+                "in one process\n", argv[0]);
+        return -1;
+    }
+
+    return 0;
 }
 
 /**
@@ -105,28 +294,41 @@ static blkcnt_t *init_sums(int file_count) {
 }
 
 /**
- * enqueue_tasks - Creates and enqueues initial tasks for all input paths.
+ * create_tasks - Creates the initial tasks for all input paths.
  * @system: Pointer to the system structure.
  * @argv: Command-line argument vector.
  * @argc: Argument count.
  * @optind: Index of first non-option argument.
  * @sums: Array for storing block count results.
+ * @stack: Stack to push the tasks onto, first argument on top.
  *
  * Returns: 0 on success, -1 on failure.
  */
-static int enqueue_tasks(System *system, char **argv, int argc, int optind, blkcnt_t *sums)
+static int create_tasks(System *system, char **argv, int argc, int optind, blkcnt_t *sums, TaskStack *stack)
 {
-    for (int i = optind; i < argc; i++) {
+    /* Estimate mode starts several probes per root, exact mode one task */
+    int per_root = system_probe_start(system);
+
+    for (int n = (argc - optind) * per_root - 1; n >= 0; n--) {
+        int root = n / per_root;
         Task *task = malloc(sizeof(Task));
         if (!task) {
             perror("malloc task");
             return -1;
         }
 
-        strlcpy(task->path, argv[i], PATH_MAX);
-        task->sum = &sums[i - optind];
+        strlcpy(task->path, argv[optind + root], PATH_MAX);
+        task->sum = &sums[root];
+        task->root = root;
+        task->dev = system->root_devs[root];
+        task->weight = 1.0;
+        task->estimate = 0.0;
+        task->priority = 0.0;
+        task->rec = SNAP_NONE;
+        task->parent = SNAP_NONE;
+        task->depth = 0;
 
-        if (system_enqueue(system, task) != 0) {
+        if (stack_push(stack, task) != 0) {
             free(task);
             return -1;
         }
@@ -134,6 +336,77 @@ static int enqueue_tasks(System *system, char **argv, int argc, int optind, blkc
     return 0;
 }
 
+/**
+ * run_tasks - Walks the tasks on the main thread, then hands what is left to the pool.
+ * @system: Pointer to the system structure.
+ * @stack: Initial tasks.
+ * @threads: Array of worker thread identifiers.
+ *
+ * With -j 1 the whole walk runs on the main thread without any locking.
+ * With more threads the main thread first walks for up to SMALL_TREE_TIME
+ * seconds, so small trees finish before any thread is created while slow
+ * file systems reach the pool after a few milliseconds.
+ * Estimate mode always runs on the pool, since probes restart through it.
+ *
+ * Returns: 0 on success, -1 on failure.
+ */
+static int run_tasks(System *system, TaskStack *stack, pthread_t *threads)
+{
+    if (!system->opts->estimate) {
+        int main_id = system->n_threads;
+        WorkerCtx ctx = { .system = system, .counters = &system->counters[main_id],
+                          .children = NULL, .stack = stack,
+                          .users = system->users ? &system->users[main_id] : NULL,
+                          .groups = system->groups ? &system->groups[main_id] : NULL,
+                          .hist = system->hist ? system->hist + main_id * system->hist_stride : NULL,
+                          .dirlog = system->dirlogs ? &system->dirlogs[main_id] : NULL };
+        double budget = system->n_threads == 1 ? 0 : SMALL_TREE_TIME;
+
+        int ret = walk_serial(&ctx, stack, budget);
+        entry_buf_free(&ctx.entries);
+        if (ret != 0) {
+            system->status = 1;
+        }
+        if (stack->len == 0) {
+            return 0;
+        }
+    }
+
+    Queue *tasks = create_queue();
+    if (!tasks) {
+        return -1;
+    }
+
+    /* Keep the stack order so the pool starts where the walk stopped,
+       publishing one batch per run of tasks on the same device */
+    int ret = 0;
+    while (stack->len > 0 && ret == 0) {
+        Task *task = stack->tasks[stack->len - 1];
+        if (!is_empty(tasks) && ((Task *)peek(tasks))->dev != task->dev) {
+            ret = system_enqueue_batch(system, tasks);
+            continue;
+        }
+        ret = enqueue(tasks, task);
+        if (ret == 0) {
+            stack->len--;
+        }
+    }
+
+    if (ret == 0) {
+        ret = system_enqueue_batch(system, tasks);
+    }
+    if (ret == 0) {
+        ret = system_start(system, threads);
+    }
+
+    Task *task;
+    while ((task = dequeue(tasks)) != NULL) {
+        free(task);
+    }
+    free_queue(tasks);
+    return ret;
+}
+
 /**
  * process_files - Processes all input paths and prints block usage results.
  * @system: Pointer to the system structure.
@@ -141,29 +414,396 @@ static int enqueue_tasks(System *system, char **argv, int argc, int optind, blkc
  * @argc: Argument count.
  * @optind: Index of first non-option argument.
  * @threads: Array of worker thread identifiers.
- * @n_threads: Number of worker threads.
  *
  * Returns: 0 on success, -1 on failure.
  */
-static int process_files(System *system, char **argv, int argc, int optind, pthread_t *threads, int n_threads) {
+static int process_files(System *system, char **argv, int argc, int optind, pthread_t *threads) {
     int file_count = argc - optind;
     blkcnt_t *sums = init_sums(file_count);
     if (!sums) {
         return -1;
 	}
+
+    if (system_set_roots(system, argv + optind, file_count) != 0) {
+        free(sums);
+        return -1;
+    }
+
+    /* A bad snapshot is reported before the scan rather than after it */
+    Snapshot old = { 0 };
+    if (system->opts->diff) {
+        if (snapshot_load(&old, system->opts->diff) != 0) {
+            free(sums);
+            return -1;
+        }
+        if (system->opts->largest_first) {
+            system->prior = &old;
+        }
+    }
 	
-    if (enqueue_tasks(system, argv, argc, optind, sums) != 0) {
+    Monitor monitor;
+    if (monitor_start(&monitor, system) != 0) {
+        snapshot_free(&old);
         free(sums);
         return -1;
     }
 
-    system_join(system, threads, n_threads);
+    TaskStack stack = { NULL, 0, 0 };
+    int ret = create_tasks(system, argv, argc, optind, sums, &stack);
+    if (ret == 0) {
+        ret = run_tasks(system, &stack, threads);
+    }
+
+    system_join(system, threads);
+    if (monitor_stop(&monitor) != 0) {
+        ret = -1;
+    }
+
+    for (int i = 0; i < stack.len; i++) {
+        free(stack.tasks[i]);
+    }
+    free(stack.tasks);
+
+    if (ret != 0) {
+        snapshot_free(&old);
+        free(sums);
+        return -1;
+    }
+
+    /* A scan cut short by the deadline only has partial totals */
+    int expired = atomic_load(&system->expired);
+    if (expired && system->status == 0) {
+        system->status = 1;
+    }
+
+    if (system->opts->estimate) {
+        if (expired) {
+            fprintf(stderr, "mdu: the deadline was reached before all probes finished\n");
+        }
+        print_estimates(system, argv, optind, file_count);
+        free(sums);
+        return 0;
+    }
+
+    IdMap users = { 0 }, groups = { 0 };
+    HistBucket *hist = NULL;
+    ret = system_merge_usage(system, &users, &groups);
+    if (ret == 0 && system->hist) {
+        hist = system_merge_histograms(system);
+        ret = hist ? 0 : -1;
+    }
+
+    if (ret == 0) {
+        Report report = { .users = system->users ? &users : NULL,
+                          .groups = system->groups ? &groups : NULL,
+                          .hist = hist, .hist_kinds = system->opts->histogram };
+        print_totals(sums, argv, optind, file_count, expired, &report);
+    }
+    if (ret == 0 && system->dirlogs) {
+        ret = process_snapshots(system, &old, expired);
+    }
+    snapshot_free(&old);
+    idmap_free(&users);
+    idmap_free(&groups);
+    free(hist);
+    free(sums);
+    return ret;
+}
+
+/**
+ * process_sharded - Processes all input paths with several worker processes.
+ * @opts: Command-line options.
+ * @argv: Command-line argument vector.
+ * @argc: Argument count.
+ * @optind: Index of first non-option argument.
+ *
+ * Returns: Exit status of the program.
+ */
+static int process_sharded(const Options *opts, char **argv, int argc, int optind)
+{
+    int file_count = argc - optind;
+    blkcnt_t *sums = init_sums(file_count);
+    if (!sums) {
+        return EXIT_FAILURE;
+    }
+
+    int expired = 0;
+    int status = run_sharded(opts, argv + optind, file_count, sums, &expired);
+    if (status < 0) {
+        free(sums);
+        return EXIT_FAILURE;
+    }
+
+    Report report = { 0 };
+    print_totals(sums, argv, optind, file_count, expired, &report);
+    free(sums);
+    return status != 0 || expired ? 1 : 0;
+}
+
+/**
+ * print_totals - Prints the block usage of every input path.
+ * @sums: Block counts of the input paths.
+ * @argv: Command-line argument vector.
+ * @optind: Index of first non-option argument.
+ * @file_count: Number of input paths.
+ * @expired: Non-zero if the deadline cut the scan short.
+ * @report: Breakdowns to print below each total.
+ */
+static void print_totals(blkcnt_t *sums, char **argv, int optind, int file_count, int expired,
+                         const Report *report)
+{
+    if (expired) {
+        fprintf(stderr, "mdu: totals are incomplete, the deadline was reached\n");
+    }
 
     // +8 bc initial directory block not counted
     for (int i = 0; i < file_count; i++){
-        printf("%-8ld %s\n", sums[i] + 8, argv[i + optind]);
+        printf("%-8ld %s%s\n", sums[i] + 8, argv[i + optind], expired ? "\t(incomplete)" : "");
+        if (report->users) {
+            print_usage(report->users, i, 0);
+        }
+        if (report->groups) {
+            print_usage(report->groups, i, 1);
+        }
+        for (int k = 0; k < HIST_KINDS; k++) {
+            if (report->hist && (report->hist_kinds & (1 << k))) {
+                print_histogram(report->hist + ((size_t)i * HIST_KINDS + k) * HIST_BUCKETS, k);
+            }
+        }
 	}
-	
-    free(sums);
+}
+
+/**
+ * print_usage - Prints the block usage of one input path by owner or group.
+ * @map: Merged usage map.
+ * @root: Index of the input path.
+ * @by_group: Non-zero if @map is keyed by group id.
+ */
+static void print_usage(const IdMap *map, int root, int by_group)
+{
+    size_t n;
+    IdUsage *usage = idmap_collect(map, root, &n);
+
+    for (size_t i = 0; i < n; i++) {
+        const char *name = NULL;
+        if (by_group) {
+            struct group *gr = getgrgid(usage[i].id);
+            name = gr ? gr->gr_name : NULL;
+        } else {
+            struct passwd *pw = getpwuid(usage[i].id);
+            name = pw ? pw->pw_name : NULL;
+        }
+
+        if (name) {
+            printf("%-8ld   %s:%s\n", usage[i].blocks, by_group ? "group" : "user", name);
+        } else {
+            printf("%-8ld   %s:%u\n", usage[i].blocks, by_group ? "group" : "user", usage[i].id);
+        }
+    }
+    free(usage);
+}
+
+/**
+ * print_estimates - Prints estimated block usage with a 95% confidence interval.
+ * @system: Pointer to the system structure.
+ * @argv: Command-line argument vector.
+ * @optind: Index of first non-option argument.
+ * @file_count: Number of input paths.
+ */
+static void print_estimates(System *system, char **argv, int optind, int file_count)
+{
+    for (int i = 0; i < file_count; i++) {
+        Estimate *est = &system->estimates[i];
+        double ci = 0.0;
+        if (est->n > 1) {
+            ci = Z_95 * sqrt(est->m2 / (est->n - 1)) / sqrt(est->n);
+        }
+
+        // +8 bc initial directory block not counted
+        printf("%-8ld %s\t+-%ld (95%% confidence, %ld probes)\n",
+               (long)llround(est->mean) + 8, argv[i + optind], (long)llround(ci), est->n);
+    }
+}
+
+/**
+ * parse_histograms - Parses the argument of --histogram.
+ * @arg: Comma-separated list of size, atime and mtime, or NULL for all.
+ *
+ * Return: Bit mask of HIST_* kinds, or -1 on an unknown name.
+ */
+static int parse_histograms(const char *arg)
+{
+    static const char *names[HIST_KINDS] = {
+        [HIST_SIZE] = "size", [HIST_ATIME] = "atime", [HIST_MTIME] = "mtime"
+    };
+
+    if (!arg) {
+        return (1 << HIST_KINDS) - 1;
+    }
+
+    int kinds = 0;
+    while (*arg) {
+        size_t len = strcspn(arg, ",");
+        int k = 0;
+        while (k < HIST_KINDS && (strlen(names[k]) != len || strncmp(arg, names[k], len) != 0)) {
+            k++;
+        }
+        if (k == HIST_KINDS) {
+            return -1;
+        }
+        kinds |= 1 << k;
+        arg += len + (arg[len] == ',');
+    }
+    return kinds ? kinds : -1;
+}
+
+/**
+ * parse_size - Parses a byte count with an optional K, M or G suffix.
+ * @arg: Argument to parse.
+ * @bytes: Set to the parsed count.
+ *
+ * Return: 0 on success, or -1 if @arg is not a size.
+ */
+static int parse_size(const char *arg, size_t *bytes)
+{
+    char *end;
+    double value = strtod(arg, &end);
+    if (end == arg || value < 0) {
+        return -1;
+    }
+
+    switch (*end) {
+    case 'G': case 'g':
+        value *= 1024;
+        /* fall through */
+    case 'M': case 'm':
+        value *= 1024;
+        /* fall through */
+    case 'K': case 'k':
+        value *= 1024;
+        end++;
+        break;
+    }
+    if (*end != '\0') {
+        return -1;
+    }
+    *bytes = (size_t)value;
     return 0;
 }
+
+/**
+ * print_histogram - Prints the non-empty buckets of one histogram.
+ * @hist: HIST_BUCKETS buckets.
+ * @kind: HIST_SIZE, HIST_ATIME or HIST_MTIME.
+ */
+static void print_histogram(const HistBucket *hist, int kind)
+{
+    static const char *titles[HIST_KINDS] = {
+        [HIST_SIZE] = "size", [HIST_ATIME] = "atime age", [HIST_MTIME] = "mtime age"
+    };
+    char low[16], high[16];
+
+    printf("         %s histogram (files, blocks):\n", titles[kind]);
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        if (hist[b].count == 0) {
+            continue;
+        }
+        format_bound(low, sizeof(low), kind, b);
+        format_bound(high, sizeof(high), kind, b + 1);
+        printf("         [%6s, %6s)  %10lu  %10ld\n", low, high,
+               (unsigned long)hist[b].count, (long)hist[b].blocks);
+    }
+}
+
+/**
+ * format_bound - Formats the lower bound of a bucket, 0 or 2^(bucket-1).
+ * @buf: Output buffer.
+ * @len: Size of @buf.
+ * @kind: HIST_SIZE for bytes, otherwise seconds.
+ * @bucket: Bucket index.
+ */
+static void format_bound(char *buf, size_t len, int kind, int bucket)
+{
+    static const char *bytes[] = { "B", "K", "M", "G", "T", "P", "E" };
+    static const struct { const char *unit; double seconds; } ages[] = {
+        { "y", 365.0 * 86400 }, { "d", 86400 }, { "h", 3600 }, { "m", 60 }, { "s", 1 }
+    };
+
+    if (bucket == 0) {
+        snprintf(buf, len, "0");
+        return;
+    }
+
+    double value = ldexp(1.0, bucket - 1);
+    if (kind == HIST_SIZE) {
+        int u = 0;
+        while (value >= 1024 && u < 6) {
+            value /= 1024;
+            u++;
+        }
+        snprintf(buf, len, "%.0f%s", value, bytes[u]);
+        return;
+    }
+
+    int u = 0;
+    while (u < 4 && value < ages[u].seconds) {
+        u++;
+    }
+    snprintf(buf, len, "%.0f%s", value / ages[u].seconds, ages[u].unit);
+}
+
+/**
+ * process_snapshots - Builds the snapshot of a finished scan, diffs and saves it.
+ * @system: Pointer to the system structure, with all workers joined.
+ * @old: Snapshot loaded for --diff, empty if none.
+ * @expired: Non-zero if the scan was cut short by the deadline.
+ *
+ * A partial scan would show every unread directory as shrunk, so nothing
+ * is diffed or saved after the deadline.
+ *
+ * Return: 0 on success, or -1 on error.
+ */
+static int process_snapshots(System *system, const Snapshot *old, int expired)
+{
+    if (expired) {
+        fprintf(stderr, "mdu: the scan is incomplete, no snapshot was diffed or saved\n");
+        return 0;
+    }
+
+    Snapshot snap;
+    if (snapshot_build(&snap, system->dirlogs, system->n_threads + 1) != 0) {
+        return -1;
+    }
+
+    int ret = 0;
+    if (system->opts->diff) {
+        print_diff(old, &snap, system->opts->diff);
+    }
+    if (system->opts->save && snapshot_save(&snap, system->opts->save) != 0) {
+        ret = -1;
+    }
+    snapshot_free(&snap);
+    return ret;
+}
+
+/**
+ * print_diff - Prints the directories that grew and shrank the most.
+ * @old: Snapshot loaded for --diff.
+ * @new: Snapshot of this scan.
+ * @file: Name of the --diff file.
+ */
+static void print_diff(const Snapshot *old, const Snapshot *new, const char *file)
+{
+    DiffRow grown[DIFF_TOP], shrunk[DIFF_TOP];
+    int n_grown, n_shrunk;
+    snapshot_diff(old, new, DIFF_TOP, grown, &n_grown, shrunk, &n_shrunk);
+
+    printf("Largest growth since %s:\n", file);
+    for (int i = 0; i < n_grown; i++) {
+        printf("%+-8ld %s\n", (long)grown[i].delta, grown[i].path);
+    }
+    printf("Largest shrink since %s:\n", file);
+    for (int i = 0; i < n_shrunk; i++) {
+        printf("%+-8ld %s\n", (long)shrunk[i].delta, shrunk[i].path);
+    }
+}
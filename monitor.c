@@ -0,0 +1,327 @@
+/**
+ * monitor.c - Progress reporting and deadline handling for the scan.
+ *
+ * The monitor thread wakes up at a fixed interval and prints the sum of
+ * the workers' live counters to stderr. It reads them with relaxed loads,
+ * so workers never wait on it. When a deadline is given, it flags the
+ * system as expired so workers stop starting new directories.
+ *
+ * Author: Rasmus Mikaelsson (et24rmn)
+ * Version: 12-01-2026
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "monitor.h"
+#include "system.h"
+
+/* ------------------ Declarations of internal functions ------------------ */
+
+static int monitor_run(Monitor *monitor, System *system);
+static void *monitor_loop(void *args);
+static int monitor_wait(Monitor *monitor, double wake, double now);
+static void report(Monitor *monitor, double now, long *last_entries, double *last_time);
+static struct timespec realtime_after(double seconds);
+static int unlock_mutex(pthread_mutex_t *m);
+static int lock_mutex(pthread_mutex_t *m);
+static int signal_cond(pthread_cond_t *cond);
+static int wait_cond(pthread_cond_t *cond, pthread_mutex_t *lock);
+
+/* -------------------------- External functions -------------------------- */
+
+int monitor_start(Monitor *monitor, System *system)
+{
+    monitor->start = monotonic_seconds();
+    monitor->deadline = system->opts->deadline > 0 ? monitor->start + system->opts->deadline : 0;
+    monitor->quiet = 0;
+    return monitor_run(monitor, system);
+}
+
+int monitor_start_until(Monitor *monitor, System *system, double deadline)
+{
+    monitor->start = monotonic_seconds();
+    monitor->deadline = deadline;
+    monitor->quiet = 1;
+    return monitor_run(monitor, system);
+}
+
+int monitor_stop(Monitor *monitor)
+{
+    if (!monitor->running) {
+        return 0;
+    }
+
+    /* A thread that stopped after an error may have left the lock in any state */
+    if (!atomic_load(&monitor->failed)) {
+        /* Without the lock the thread cannot be told to stop, so it is not joined */
+        if (lock_mutex(&monitor->lock) != 0) {
+            return -1;
+        }
+        monitor->stop = 1;
+        int ret = signal_cond(&monitor->cond);
+        if (unlock_mutex(&monitor->lock) != 0 || ret != 0) {
+            return -1;
+        }
+    }
+
+    int ret = pthread_join(monitor->thread, NULL);
+    if (ret != 0) {
+        fprintf(stderr, "pthread_join failed: %s\n", strerror(ret));
+        return -1;
+    }
+
+    pthread_cond_destroy(&monitor->cond);
+    pthread_mutex_destroy(&monitor->lock);
+    monitor->running = 0;
+    return atomic_load(&monitor->failed) ? -1 : 0;
+}
+
+/* -------------------------- Internal functions -------------------------- */
+
+/**
+ * monitor_run - Starts the monitor thread once its deadline is set.
+ * @monitor: Pointer to the monitor to start.
+ * @system: Pointer to the system structure.
+ *
+ * No thread is started if neither progress reports nor a deadline were requested.
+ *
+ * Return: 0 on success, -1 on failure.
+ */
+static int monitor_run(Monitor *monitor, System *system)
+{
+    monitor->running = 0;
+    if (system->opts->progress <= 0 && monitor->deadline <= 0) {
+        return 0;
+    }
+
+    monitor->stop = 0;
+    monitor->system = system;
+    atomic_init(&monitor->failed, 0);
+
+    int ret = pthread_mutex_init(&monitor->lock, NULL);
+    if (ret != 0) {
+        fprintf(stderr, "pthread_mutex_init failed: %s\n", strerror(ret));
+        return -1;
+    }
+
+    ret = pthread_cond_init(&monitor->cond, NULL);
+    if (ret != 0) {
+        fprintf(stderr, "pthread_cond_init failed: %s\n", strerror(ret));
+        pthread_mutex_destroy(&monitor->lock);
+        return -1;
+    }
+
+    ret = pthread_create(&monitor->thread, NULL, monitor_loop, monitor);
+    if (ret != 0) {
+        fprintf(stderr, "pthread creation failed\n");
+        pthread_cond_destroy(&monitor->cond);
+        pthread_mutex_destroy(&monitor->lock);
+        return -1;
+    }
+
+    monitor->running = 1;
+    return 0;
+}
+
+/**
+ * monitor_loop - Monitor thread routine.
+ * @args: Pointer to the Monitor struct.
+ *
+ * Sleeps until the next report or the deadline, whichever comes first,
+ * and returns once monitor_stop() has been called. If a lock or wait
+ * fails the thread stops right away and flags @failed, leaving the
+ * mutex alone since its state is unknown.
+ *
+ * Return: Always NULL.
+ */
+static void *monitor_loop(void *args)
+{
+    Monitor *monitor = (Monitor *)args;
+    const Options *opts = monitor->system->opts;
+    double deadline = monitor->deadline;
+    double next_report = opts->progress > 0 ? monitor->start + opts->progress : 0;
+    long last_entries = 0;
+    double last_time = monitor->start;
+
+    int failed = lock_mutex(&monitor->lock) != 0;
+    while (!failed && !monitor->stop) {
+        double now = monotonic_seconds();
+        double wake = next_report;
+        if (deadline > 0 && (wake == 0 || deadline < wake)) {
+            wake = deadline;
+        }
+
+        if (wake == 0 || now < wake) {
+            failed = monitor_wait(monitor, wake, now) != 0;
+            continue;
+        }
+
+        if (deadline > 0 && now >= deadline) {
+            atomic_store_explicit(&monitor->system->expired, 1, memory_order_relaxed);
+            if (!monitor->quiet) {
+                fprintf(stderr, "mdu: deadline of %g s reached, finishing directories in progress\n",
+                        opts->deadline);
+            }
+            deadline = 0;
+        }
+
+        if (next_report > 0 && now >= next_report) {
+            report(monitor, now, &last_entries, &last_time);
+            next_report += opts->progress;
+        }
+    }
+    if (!failed) {
+        failed = unlock_mutex(&monitor->lock) != 0;
+    }
+    if (failed) {
+        fprintf(stderr, "mdu: progress and deadline monitor stopped\n");
+        atomic_store(&monitor->failed, 1);
+        return NULL;
+    }
+
+    if (opts->progress > 0) {
+        report(monitor, monotonic_seconds(), &last_entries, &last_time);
+    }
+    return NULL;
+}
+
+/**
+ * monitor_wait - Sleeps until @wake or until monitor_stop() signals.
+ * @monitor: Pointer to the monitor, with its lock held.
+ * @wake: Monotonic time in seconds to wake up at, 0 to wait for a signal only.
+ * @now: Current monotonic time in seconds.
+ *
+ * Only progress reports are left once the deadline has fired, and with
+ * none of those either the thread just waits to be stopped.
+ *
+ * Return: 0 on wakeup or timeout, -1 on failure.
+ */
+static int monitor_wait(Monitor *monitor, double wake, double now)
+{
+    if (wake == 0) {
+        return wait_cond(&monitor->cond, &monitor->lock);
+    }
+
+    struct timespec ts = realtime_after(wake - now);
+    int ret = pthread_cond_timedwait(&monitor->cond, &monitor->lock, &ts);
+    if (ret != 0 && ret != ETIMEDOUT) {
+        fprintf(stderr, "pthread_cond_timedwait failed: %s\n", strerror(ret));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * report - Prints one progress line to stderr.
+ * @monitor: Pointer to the monitor.
+ * @now: Current monotonic time in seconds.
+ * @last_entries: Entry count at the previous report, updated.
+ * @last_time: Time of the previous report, updated.
+ */
+static void report(Monitor *monitor, double now, long *last_entries, double *last_time)
+{
+    System *system = monitor->system;
+    long entries = 0, dirs = 0, blocks = 0;
+
+    for (int i = 0; i <= system->n_threads; i++) {
+        entries += atomic_load_explicit(&system->counters[i].entries, memory_order_relaxed);
+        dirs += atomic_load_explicit(&system->counters[i].dirs, memory_order_relaxed);
+        blocks += atomic_load_explicit(&system->counters[i].blocks, memory_order_relaxed);
+    }
+
+    double rate = now > *last_time ? (entries - *last_entries) / (now - *last_time) : 0;
+    fprintf(stderr, "mdu: %.1fs  %ld entries (%.0f/s)  %ld dirs  queue %d  %ld blocks\n",
+            now - monitor->start, entries, rate, dirs,
+            atomic_load_explicit(&system->pending, memory_order_relaxed), blocks);
+
+    *last_entries = entries;
+    *last_time = now;
+}
+
+/**
+ * realtime_after - Absolute CLOCK_REALTIME time for pthread_cond_timedwait.
+ * @seconds: Relative timeout in seconds.
+ *
+ * Return: Current realtime clock plus @seconds.
+ */
+static struct timespec realtime_after(double seconds)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += (time_t)seconds;
+    ts.tv_nsec += (long)((seconds - (time_t)seconds) * 1e9);
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return ts;
+}
+
+/**
+ * unlock_mutex - Unlocks a mutex.
+ * @m: Pointer to the mutex to unlock.
+ *
+ * Return: 0 on success, -1 on failure.
+ */
+static int unlock_mutex(pthread_mutex_t *m)
+{
+    int ret = pthread_mutex_unlock(m);
+    if (ret != 0) {
+        fprintf(stderr, "pthread_mutex_unlock failed: %s\n", strerror(ret));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * lock_mutex - Locks a mutex.
+ * @m: Pointer to the mutex to lock.
+ *
+ * Return: 0 on success, -1 on failure.
+ */
+static int lock_mutex(pthread_mutex_t *m)
+{
+    int ret = pthread_mutex_lock(m);
+    if (ret != 0) {
+        fprintf(stderr, "pthread_mutex_lock failed: %s\n", strerror(ret));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * signal_cond - Wakes one thread waiting on a condition variable.
+ * @cond: Pointer to the condition variable to signal.
+ *
+ * Return: 0 on success, -1 on failure.
+ */
+static int signal_cond(pthread_cond_t *cond)
+{
+    int ret = pthread_cond_signal(cond);
+    if (ret != 0) {
+        fprintf(stderr, "pthread_cond_signal failed: %s\n", strerror(ret));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * wait_cond - Waits on a condition variable.
+ * @cond: Pointer to the condition variable to wait on.
+ * @lock: Pointer to the associated mutex.
+ *
+ * Return: 0 on success, -1 on failure.
+ */
+static int wait_cond(pthread_cond_t *cond, pthread_mutex_t *lock)
+{
+    int ret = pthread_cond_wait(cond, lock);
+    if (ret != 0) {
+        fprintf(stderr, "pthread_cond_wait failed: %s\n", strerror(ret));
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,76 @@
+/**
+ * monitor.h - Header for the progress and deadline monitor thread.
+ *
+ * Defines the Monitor struct and functions to start and stop a thread
+ * that periodically reports scan progress on stderr and cuts the scan
+ * short once a deadline has passed.
+ *
+ * Author: Rasmus Mikaelsson (et24rmn)
+ * Version: 12-01-2026
+ */
+
+#ifndef MONITOR_H
+#define MONITOR_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "system.h"
+
+/**
+ * struct Monitor - State of the monitor thread.
+ * @thread: Monitor thread identifier.
+ * @lock: Mutex protecting @stop.
+ * @cond: Condition variable used to sleep between reports and to stop early.
+ * @stop: Set when the scan has finished.
+ * @running: Non-zero if the thread was started.
+ * @system: Pointer to the monitored system.
+ * @start: Monotonic time in seconds when the scan started.
+ * @deadline: Monotonic time in seconds when the scan expires, 0 for none.
+ * @quiet: Non-zero if the caller reports the deadline itself.
+ * @failed: Set by the thread when a lock or wait failed and it stopped.
+ */
+typedef struct Monitor {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int stop;
+    int running;
+    System *system;
+    double start;
+    double deadline;
+    int quiet;
+    atomic_int failed;
+} Monitor;
+
+/**
+ * monitor_start - Starts the monitor thread if progress or a deadline was requested.
+ * @monitor: Pointer to the monitor to start.
+ * @system: Pointer to the system structure.
+ *
+ * Return: 0 on success, -1 on failure.
+ */
+int monitor_start(Monitor *monitor, System *system);
+
+/**
+ * monitor_start_until - Starts the monitor thread with a deadline set by another process.
+ * @monitor: Pointer to the monitor to start.
+ * @system: Pointer to the system structure.
+ * @deadline: Monotonic time in seconds when the scan expires, 0 for none.
+ *
+ * Used by the worker processes of --procs, which share one deadline taken
+ * by the coordinator. Reaching it only flags @system as expired; the
+ * coordinator prints the message once.
+ *
+ * Return: 0 on success, -1 on failure.
+ */
+int monitor_start_until(Monitor *monitor, System *system, double deadline);
+
+/**
+ * monitor_stop - Stops the monitor thread and prints a final report.
+ * @monitor: Pointer to the monitor to stop.
+ *
+ * Return: 0 on success, -1 on failure or if the thread stopped after an error.
+ */
+int monitor_stop(Monitor *monitor);
+
+#endif
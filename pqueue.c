@@ -0,0 +1,101 @@
+/**
+ * pqueue.c - Generic priority queue implementation.
+ *
+ * Provides a binary max-heap of generic pointers, each stored with a
+ * numeric key. The heap lives in one array that doubles when full, so
+ * pushes and pops allocate nothing in the common case.
+ *
+ * Author: Rasmus Mikaelsson (et24rmn)
+ * Version: 12-01-2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "pqueue.h"
+
+typedef struct Entry {
+	double key;
+	void *value;
+} Entry;
+
+struct PQueue {
+	Entry *heap;
+	int size;
+	int cap;
+};
+
+PQueue *create_pqueue(void) {
+	PQueue *pq = calloc(1, sizeof(PQueue));
+	if(!pq) {
+		perror("calloc pqueue creation");
+		return NULL;
+	}
+	return pq;
+}
+
+int pq_size(PQueue *pq) {
+	if(!pq) return 0;
+	return pq->size;
+}
+
+int pq_push(PQueue *pq, void *item, double key) {
+	if(!pq) return -1;
+
+	if(pq->size == pq->cap) {
+		int cap = pq->cap ? pq->cap * 2 : 64;
+		Entry *heap = realloc(pq->heap, cap * sizeof(Entry));
+		if(!heap) {
+			perror("realloc pqueue");
+			return -1;
+		}
+		pq->heap = heap;
+		pq->cap = cap;
+	}
+
+	// Sift up: move smaller parents down until the slot fits
+	int i = pq->size++;
+	while(i > 0) {
+		int parent = (i - 1) / 2;
+		if(pq->heap[parent].key >= key) {
+			break;
+		}
+		pq->heap[i] = pq->heap[parent];
+		i = parent;
+	}
+	pq->heap[i] = (Entry){ key, item };
+	return 0;
+}
+
+void *pq_pop(PQueue *pq) {
+	if(!pq || pq->size == 0) return NULL;
+
+	void *top = pq->heap[0].value;
+	Entry last = pq->heap[--pq->size];
+
+	// Sift down: move larger children up until the last entry fits
+	int i = 0;
+	while(1) {
+		int child = 2 * i + 1;
+		if(child >= pq->size) {
+			break;
+		}
+		if(child + 1 < pq->size && pq->heap[child + 1].key > pq->heap[child].key) {
+			child++;
+		}
+		if(last.key >= pq->heap[child].key) {
+			break;
+		}
+		pq->heap[i] = pq->heap[child];
+		i = child;
+	}
+	if(pq->size > 0) {
+		pq->heap[i] = last;
+	}
+	return top;
+}
+
+void free_pqueue(PQueue *pq) {
+	if(!pq) return;
+	free(pq->heap);
+	free(pq);
+}
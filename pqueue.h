@@ -0,0 +1,57 @@
+/**
+ * pqueue.h - Generic priority queue implementation.
+ *
+ * Provides a binary max-heap of generic pointers, each stored with a
+ * numeric key. The element with the largest key is removed first.
+ * The queue does not manage element memory.
+ *
+ * Author: Rasmus Mikaelsson (et24rmn)
+ * Version: 12-01-2026
+ */
+
+#ifndef PQUEUE_H
+#define PQUEUE_H
+
+typedef struct PQueue PQueue;
+
+/**
+ * Creates a new, empty priority queue.
+ *
+ * @return		Created, empty priority queue, NULL on failure
+ */
+PQueue *create_pqueue(void);
+
+/**
+ * Gets the size of a given priority queue
+ *
+ * @param pq	Pointer to priority queue
+ * @return		Number of elements
+ */
+int pq_size(PQueue *pq);
+
+/**
+ * Adds an item with the given key.
+ *
+ * @param pq	Pointer to priority queue
+ * @param item	Item to add
+ * @param key	Priority of the item, larger is removed first
+ * @return		0 on success, -1 on failure
+ */
+int pq_push(PQueue *pq, void *item, double key);
+
+/**
+ * Removes the item with the largest key.
+ *
+ * @param pq	Pointer to priority queue
+ * @return		Pointer to the removed element, or NULL if empty
+ */
+void *pq_pop(PQueue *pq);
+
+/**
+ * Frees the priority queue. Remaining elements are not freed.
+ *
+ * @param pq	Pointer to priority queue to be destroyed
+ */
+void free_pqueue(PQueue *pq);
+
+#endif
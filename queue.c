@@ -98,6 +98,50 @@ void *dequeue(Queue *q) {
 	return value;
 }
 
+int append_queue(Queue *dst, Queue *src) {
+	if(!dst || !src) return -1;
+	if(is_empty(src)) return 0;
+
+	int moved = src->size;
+	if(is_empty(dst)) {
+		dst->head = src->head;
+	} else {
+		dst->tail->next = src->head;
+	}
+	dst->tail = src->tail;
+	dst->size += moved;
+
+	src->head = NULL;
+	src->tail = NULL;
+	src->size = 0;
+	return moved;
+}
+
+int take_front(Queue *dst, Queue *src, int n) {
+	if(!dst || !src) return -1;
+	if(n <= 0 || is_empty(src)) return 0;
+	if(n >= src->size) return append_queue(dst, src);
+
+	// Find the last node of the chain to move
+	Node *last = src->head;
+	for(int i = 1; i < n; i++) {
+		last = last->next;
+	}
+
+	if(is_empty(dst)) {
+		dst->head = src->head;
+	} else {
+		dst->tail->next = src->head;
+	}
+	dst->tail = last;
+	dst->size += n;
+
+	src->head = last->next;
+	src->size -= n;
+	last->next = NULL;
+	return n;
+}
+
 void free_queue(Queue *q) {
 	if(!q) return;
 	
@@ -64,6 +64,28 @@ int enqueue(Queue *q, void *item);
  */
 void *dequeue(Queue *q);
 
+/**
+ * Moves every element of src to the back of dst in constant time. No
+ * nodes are allocated or freed, so a chain built in a private queue can be
+ * published with a single short critical section. src is left empty.
+ *
+ * @param dst	Queue to append to
+ * @param src	Queue whose elements are moved
+ * @return		Number of elements moved, -1 on invalid queue
+ */
+int append_queue(Queue *dst, Queue *src);
+
+/**
+ * Moves up to n elements from the front of src to the back of dst,
+ * keeping their order. No nodes are allocated or freed.
+ *
+ * @param dst	Queue to append to
+ * @param src	Queue to take elements from
+ * @param n		Maximum number of elements to move
+ * @return		Number of elements moved, -1 on invalid queue
+ */
+int take_front(Queue *dst, Queue *src, int n);
+
 /**
  * frees all the queues allocated memory on the heap
  *
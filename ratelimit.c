@@ -0,0 +1,98 @@
+/**
+ * ratelimit.c - Shared I/O rate limiter.
+ *
+ * Running mdu next to a production database must not eat the metadata
+ * IOPS the database needs. Workers take tokens from a shared bucket
+ * before each stat and directory read. To keep the bucket from becoming
+ * a contention point, each worker fetches a batch worth about 10 ms of
+ * the rate at a time and spends it locally.
+ *
+ * Author: Rasmus Mikaelsson (et24rmn)
+ * Version: 12-01-2026
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "ratelimit.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+/* Largest batch of tokens a thread fetches at once */
+#define BATCH_MAX 64
+
+/* ioprio_set(2) has no glibc wrapper or constants */
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+
+/* Nanoseconds the calling thread has slept waiting for tokens */
+static __thread int64_t slept_ns;
+
+/* ------------------ Declarations of internal functions ------------------ */
+
+static int64_t monotonic_ns(void);
+
+/* -------------------------- External functions -------------------------- */
+
+void ratelimit_init(RateLimit *rl, double rate)
+{
+    rl->interval_ns = rate > 0 ? MAX((int64_t)(1e9 / rate), 1) : 0;
+    rl->batch = MAX(1, MIN((int)(rate / 100), BATCH_MAX));
+    atomic_init(&rl->tat, monotonic_ns());
+}
+
+void ratelimit_refill(RateLimit *rl, int *cache)
+{
+    int64_t cost = rl->interval_ns * rl->batch;
+    int64_t now = monotonic_ns();
+    long long old = atomic_load_explicit(&rl->tat, memory_order_relaxed);
+    long long start;
+
+    /* Reserve the next batch; an idle bucket does not bank unused time */
+    do {
+        start = MAX(old, now);
+    } while (!atomic_compare_exchange_weak_explicit(&rl->tat, &old, start + cost,
+                                                    memory_order_relaxed, memory_order_relaxed));
+
+    /* The batch may be spent once its first token is due */
+    if (start > now) {
+        struct timespec ts = { (start - now) / 1000000000LL, (start - now) % 1000000000LL };
+        while (nanosleep(&ts, &ts) != 0) {
+        }
+        /* Measured, since timer slack makes the sleep overshoot */
+        slept_ns += monotonic_ns() - now;
+    }
+    *cache += rl->batch;
+}
+
+int64_t ratelimit_slept_ns(void)
+{
+    return slept_ns;
+}
+
+int set_idle_io_priority(void)
+{
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) != 0) {
+        perror("ioprio_set");
+        return -1;
+    }
+    return 0;
+}
+
+/* -------------------------- Internal functions -------------------------- */
+
+/**
+ * monotonic_ns - Reads the monotonic clock.
+ *
+ * Return: Nanoseconds since an arbitrary fixed point.
+ */
+static int64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
@@ -0,0 +1,81 @@
+/**
+ * ratelimit.h - Header for the shared I/O rate limiter.
+ *
+ * Defines a token bucket shared by all workers and helpers to fetch its
+ * tokens in per-thread batches, plus a helper that moves the calling
+ * thread to the idle I/O scheduling class.
+ *
+ * Author: Rasmus Mikaelsson (et24rmn)
+ * Version: 12-01-2026
+ */
+
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/**
+ * struct RateLimit - Token bucket implemented as a generic cell rate algorithm.
+ * @interval_ns: Nanoseconds per token, 0 if unlimited.
+ * @batch: Tokens fetched at a time by one thread.
+ * @tat: Theoretical arrival time in nanoseconds of the next free token.
+ *
+ * The whole bucket state is one atomic timestamp, so fetching a batch is
+ * a single compare-and-swap and never takes a lock.
+ */
+typedef struct RateLimit {
+    int64_t interval_ns;
+    int batch;
+    atomic_llong tat;
+} RateLimit;
+
+/**
+ * ratelimit_init - Initializes a rate limiter.
+ * @rl: Pointer to the limiter.
+ * @rate: Tokens per second, 0 for no limit.
+ */
+void ratelimit_init(RateLimit *rl, double rate);
+
+/**
+ * ratelimit_acquire - Takes one token, sleeping if the rate is exceeded.
+ * @rl: Pointer to the limiter.
+ * @cache: Tokens already fetched by the calling thread, updated.
+ *
+ * Only touches the shared state once every @rl->batch calls.
+ */
+static inline void ratelimit_acquire(RateLimit *rl, int *cache);
+
+/**
+ * ratelimit_refill - Fetches a batch of tokens into a thread's cache.
+ * @rl: Pointer to the limiter.
+ * @cache: Tokens already fetched by the calling thread, updated.
+ */
+void ratelimit_refill(RateLimit *rl, int *cache);
+
+/**
+ * ratelimit_slept_ns - Time the calling thread has spent waiting for tokens.
+ *
+ * Return: Nanoseconds slept in ratelimit_refill() by the calling thread.
+ */
+int64_t ratelimit_slept_ns(void);
+
+/**
+ * set_idle_io_priority - Moves the calling thread to the idle I/O class.
+ *
+ * Return: 0 on success, -1 on failure.
+ */
+int set_idle_io_priority(void);
+
+static inline void ratelimit_acquire(RateLimit *rl, int *cache)
+{
+    if (rl->interval_ns == 0) {
+        return;
+    }
+    if (*cache == 0) {
+        ratelimit_refill(rl, cache);
+    }
+    (*cache)--;
+}
+
+#endif
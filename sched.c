@@ -0,0 +1,302 @@
+/**
+ * sched.c - Per-device task scheduler.
+ *
+ * Every device gets its own FIFO queue, or a heap in priority mode, and an
+ * in-flight limit. A device
+ * whose tasks spend most of their time waiting on I/O (NFS, spinning
+ * disks) gets more slots, since extra concurrency hides its latency. A
+ * device whose tasks are CPU-bound gets its fair share, since more
+ * threads would only take CPU away from the others. Limits only apply
+ * while more than one device has work.
+ *
+ * Author: Rasmus Mikaelsson (et24rmn)
+ * Version: 12-01-2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "sched.h"
+#include "pqueue.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+/* Upper bound on tasks taken per lock acquisition */
+#define BATCH_MAX 32
+
+/* Weight of the newest batch in the I/O share average */
+#define IO_ALPHA 0.2
+
+typedef struct Device {
+	dev_t dev;
+	Queue *queue;
+	PQueue *heap;
+	int inflight;
+	double io_share;
+} Device;
+
+struct Sched {
+	Device *devs;
+	int n_devs;
+	int cap;
+	int cursor;
+	int n_threads;
+	int size;
+	SchedKey key;
+};
+
+/* ------------------ Declarations of internal functions ------------------ */
+
+static Device *find_device(Sched *s, dev_t dev);
+static int active_devices(Sched *s);
+static int device_limit(Sched *s, Device *d, int active);
+static int device_size(Sched *s, Device *d);
+static int take_from(Sched *s, int i, Queue *dst);
+
+/* -------------------------- External functions -------------------------- */
+
+Sched *sched_create(int n_threads, SchedKey key) {
+	Sched *s = calloc(1, sizeof(Sched));
+	if(!s) {
+		perror("calloc sched");
+		return NULL;
+	}
+	s->n_threads = n_threads;
+	s->key = key;
+	return s;
+}
+
+int sched_size(Sched *s) {
+	if(!s) return 0;
+	return s->size;
+}
+
+int sched_push(Sched *s, dev_t dev, void *task) {
+	Device *d = find_device(s, dev);
+	if(!d) {
+		return -1;
+	}
+	if(s->key ? pq_push(d->heap, task, s->key(task)) : enqueue(d->queue, task)) {
+		return -1;
+	}
+	s->size++;
+	return 0;
+}
+
+int sched_append(Sched *s, dev_t dev, Queue *tasks) {
+	Device *d = find_device(s, dev);
+	if(!d) {
+		return -1;
+	}
+
+	// A heap has no splice, each task is sifted in on its own
+	if(s->key) {
+		int n = 0;
+		void *task;
+		while((task = peek(tasks)) != NULL) {
+			if(pq_push(d->heap, task, s->key(task)) != 0) {
+				s->size += n;
+				return -1;
+			}
+			dequeue(tasks);
+			n++;
+		}
+		s->size += n;
+		return n;
+	}
+
+	int n = append_queue(d->queue, tasks);
+	if(n > 0) {
+		s->size += n;
+	}
+	return n;
+}
+
+int sched_take(Sched *s, Queue *dst, int *dev) {
+	if(s->size == 0) {
+		return 0;
+	}
+
+	int active = active_devices(s);
+
+	// Round-robin over devices that are below their limit
+	for(int k = 0; k < s->n_devs; k++) {
+		int i = (s->cursor + k) % s->n_devs;
+		Device *d = &s->devs[i];
+		int limit = device_limit(s, d, active);
+		if(device_size(s, d) > 0 && d->inflight < limit) {
+			s->cursor = (i + 1) % s->n_devs;
+			*dev = i;
+			return take_from(s, i, dst);
+		}
+	}
+
+	// Every device with work is at its limit: stay work-conserving
+	for(int k = 0; k < s->n_devs; k++) {
+		int i = (s->cursor + k) % s->n_devs;
+		if(device_size(s, &s->devs[i]) > 0) {
+			s->cursor = (i + 1) % s->n_devs;
+			*dev = i;
+			return take_from(s, i, dst);
+		}
+	}
+	return 0;
+}
+
+void sched_done(Sched *s, int dev, double wall, double cpu) {
+	if(dev < 0 || dev >= s->n_devs) return;
+
+	Device *d = &s->devs[dev];
+	d->inflight--;
+	if(wall > 0) {
+		double share = 1.0 - MIN(cpu / wall, 1.0);
+		d->io_share += IO_ALPHA * (share - d->io_share);
+	}
+}
+
+void sched_free(Sched *s) {
+	if(!s) return;
+	for(int i = 0; i < s->n_devs; i++) {
+		free_queue(s->devs[i].queue);
+		free_pqueue(s->devs[i].heap);
+	}
+	free(s->devs);
+	free(s);
+}
+
+/* -------------------------- Internal functions -------------------------- */
+
+/**
+ * find_device - Finds the device entry for @dev, creating it if needed.
+ * @s: Pointer to scheduler.
+ * @dev: Device number.
+ *
+ * Scans are run over a handful of devices, so a linear search is enough.
+ *
+ * Return: Pointer to the device entry, or NULL on failure.
+ */
+static Device *find_device(Sched *s, dev_t dev) {
+	for(int i = 0; i < s->n_devs; i++) {
+		if(s->devs[i].dev == dev) {
+			return &s->devs[i];
+		}
+	}
+
+	if(s->n_devs == s->cap) {
+		int cap = s->cap ? s->cap * 2 : 4;
+		Device *devs = realloc(s->devs, cap * sizeof(Device));
+		if(!devs) {
+			perror("realloc devices");
+			return NULL;
+		}
+		s->devs = devs;
+		s->cap = cap;
+	}
+
+	Queue *queue = create_queue();
+	if(!queue) {
+		return NULL;
+	}
+	PQueue *heap = NULL;
+	if(s->key && !(heap = create_pqueue())) {
+		free_queue(queue);
+		return NULL;
+	}
+
+	// Unknown devices start out as latency-bound until measured
+	Device *d = &s->devs[s->n_devs++];
+	d->dev = dev;
+	d->queue = queue;
+	d->heap = heap;
+	d->inflight = 0;
+	d->io_share = 1.0;
+	return d;
+}
+
+/**
+ * active_devices - Counts devices with queued or in-flight tasks.
+ * @s: Pointer to scheduler.
+ *
+ * Return: Number of active devices.
+ */
+static int active_devices(Sched *s) {
+	int active = 0;
+	for(int i = 0; i < s->n_devs; i++) {
+		if(device_size(s, &s->devs[i]) > 0 || s->devs[i].inflight > 0) {
+			active++;
+		}
+	}
+	return active;
+}
+
+/**
+ * device_limit - In-flight limit of a device.
+ * @s: Pointer to scheduler.
+ * @d: Device entry.
+ * @active: Number of active devices.
+ *
+ * Between the fair share and all threads but one per other active device,
+ * interpolated by the share of time the device's tasks wait on I/O.
+ *
+ * Return: Maximum number of tasks of @d to have in flight.
+ */
+static int device_limit(Sched *s, Device *d, int active) {
+	if(active <= 1) {
+		return s->n_threads;
+	}
+
+	int fair = MAX(1, s->n_threads / active);
+	int cap = MAX(fair, s->n_threads - (active - 1));
+	return fair + (int)((cap - fair) * d->io_share + 0.5);
+}
+
+/**
+ * device_size - Number of tasks queued on a device.
+ * @s: Pointer to scheduler.
+ * @d: Device entry.
+ *
+ * Return: Size of the device's queue or heap.
+ */
+static int device_size(Sched *s, Device *d) {
+	return s->key ? pq_size(d->heap) : size(d->queue);
+}
+
+/**
+ * take_from - Moves a batch of tasks from one device to @dst.
+ * @s: Pointer to scheduler.
+ * @i: Index of the device.
+ * @dst: Queue to move tasks to.
+ *
+ * The batch occupies one in-flight slot: the slot counts workers busy on
+ * the device, not tasks.
+ *
+ * The batch scales with queue depth so deep queues are drained with few
+ * lock acquisitions while shallow queues are still shared across the pool.
+ * In priority mode the batch is the largest tasks in key order, so a small
+ * heap near the end of a scan hands its big tasks out one per worker.
+ *
+ * Return: Number of tasks moved.
+ */
+static int take_from(Sched *s, int i, Queue *dst) {
+	Device *d = &s->devs[i];
+	int share = device_size(s, d) / (2 * s->n_threads);
+	int want = MAX(1, MIN(share, BATCH_MAX));
+	int n = 0;
+
+	if(s->key) {
+		for(; n < want; n++) {
+			void *task = pq_pop(d->heap);
+			if(enqueue(dst, task) != 0) {
+				// Put it back rather than lose it
+				pq_push(d->heap, task, s->key(task));
+				break;
+			}
+		}
+	} else {
+		n = take_front(dst, d->queue, want);
+	}
+
+	d->inflight++;
+	s->size -= n;
+	return n;
+}
@@ -0,0 +1,93 @@
+/**
+ * sched.h - Per-device task scheduler.
+ *
+ * Groups tasks by the device they live on so that a slow mount cannot
+ * hold every worker while work on fast devices waits. Devices are served
+ * round-robin, each with a limit on tasks in flight that adapts to how
+ * latency-bound the device is. Within a device tasks are taken in FIFO
+ * order, or largest key first if the scheduler was given a key. None of
+ * the functions lock; callers hold the system lock.
+ *
+ * Author: Rasmus Mikaelsson (et24rmn)
+ * Version: 12-01-2026
+ */
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <sys/types.h>
+#include "queue.h"
+
+typedef struct Sched Sched;
+
+/* Priority of a task, larger keys are taken first */
+typedef double (*SchedKey)(const void *task);
+
+/**
+ * Creates a new, empty scheduler.
+ *
+ * @param n_threads	Number of workers that take tasks from it
+ * @param key		Priority of a task, or NULL for FIFO order
+ * @return			Created scheduler, NULL on failure
+ */
+Sched *sched_create(int n_threads, SchedKey key);
+
+/**
+ * Gets the number of queued tasks over all devices.
+ *
+ * @param s		Pointer to scheduler
+ * @return		Number of queued tasks
+ */
+int sched_size(Sched *s);
+
+/**
+ * Adds a task to the queue of its device.
+ *
+ * @param s		Pointer to scheduler
+ * @param dev	Device the task belongs to
+ * @param task	Task to add
+ * @return		0 on success, -1 on failure
+ */
+int sched_push(Sched *s, dev_t dev, void *task);
+
+/**
+ * Moves every task of a private queue to the queue of their device.
+ * All tasks in the queue must belong to the same device.
+ *
+ * @param s		Pointer to scheduler
+ * @param dev	Device the tasks belong to
+ * @param tasks	Queue of tasks, left empty on success
+ * @return		Number of tasks moved, -1 on failure
+ */
+int sched_append(Sched *s, dev_t dev, Queue *tasks);
+
+/**
+ * Takes a batch of tasks from the next device in round-robin order that
+ * is below its in-flight limit. Falls back to any device with queued
+ * tasks so workers never idle while there is work.
+ *
+ * @param s		Pointer to scheduler
+ * @param dst	Queue to move the tasks to
+ * @param dev	Set to the index of the chosen device, for sched_done()
+ * @return		Number of tasks taken, 0 if there are none
+ */
+int sched_take(Sched *s, Queue *dst, int *dev);
+
+/**
+ * Reports that a batch taken with sched_take() has been processed.
+ *
+ * @param s		Pointer to scheduler
+ * @param dev	Device index returned by sched_take()
+ * @param wall	Wall-clock seconds spent on the batch, not counting rate limiter sleep
+ * @param cpu	CPU seconds spent on the batch
+ */
+void sched_done(Sched *s, int dev, double wall, double cpu);
+
+/**
+ * Frees the scheduler and its queues. Queued tasks are not freed.
+ *
+ * @param s		Pointer to scheduler
+ */
+void sched_free(Sched *s);
+
+#endif
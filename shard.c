@@ -0,0 +1,453 @@
+/**
+ * shard.c - Multi-process sharded scanning.
+ *
+ * Some NFS clients limit outstanding RPCs per process, so past a point
+ * more threads in one process stop helping. Here the coordinator reads
+ * the top level of every argument itself and turns each subdirectory into
+ * a shard. The shards are published in a shared memory region before
+ * forking, so the work queue is just an atomic cursor that the worker
+ * processes advance without locks. Each worker process feeds its own
+ * System pool and adds its per-argument totals to shared atomic sums when
+ * it is done. The rate limiters and the --deadline time live in the
+ * region too, so they bound the coordinator and all processes together.
+ *
+ * Author: Rasmus Mikaelsson (et24rmn)
+ * Version: 12-01-2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <linux/limits.h>
+
+#include "shard.h"
+#include "system.h"
+#include "monitor.h"
+
+/**
+ * struct Shard - A top-level directory handed to one worker process.
+ * @root: Index of the argument the directory belongs to.
+ * @dev: Device of the directory.
+ * @path: Offset of the path in the region's string area.
+ */
+typedef struct Shard {
+    int root;
+    dev_t dev;
+    size_t path;
+} Shard;
+
+/**
+ * struct Region - Layout of the shared memory region.
+ * @next: Index of the next unclaimed shard.
+ * @n_shards: Number of shards.
+ * @deadline: Monotonic time in seconds when the scan expires, 0 for none.
+ * @expired: Set by the coordinator or a process that hit the deadline.
+ * @status: Set by a process that could not read some path.
+ * @iops: Limiter for --max-iops, shared by all processes.
+ * @dirs: Limiter for --max-dirs-per-sec, shared by all processes.
+ * @sums: Per-argument totals, followed by the shards and their paths.
+ *
+ * Lock-free atomics are address-free, so they work across processes.
+ */
+typedef struct Region {
+    atomic_long next;
+    long n_shards;
+    double deadline;
+    atomic_int expired;
+    atomic_int status;
+    RateLimit iops;
+    RateLimit dirs;
+    atomic_long sums[];
+} Region;
+
+/**
+ * struct ShardList - Shards collected by the coordinator before forking.
+ * @shards: Shards.
+ * @n: Number of shards.
+ * @cap: Capacity of @shards.
+ * @paths: Packed, NUL-terminated paths.
+ * @paths_len: Bytes used in @paths.
+ * @paths_cap: Capacity of @paths.
+ */
+typedef struct ShardList {
+    Shard *shards;
+    long n;
+    long cap;
+    char *paths;
+    size_t paths_len;
+    size_t paths_cap;
+} ShardList;
+
+/* Poll interval of a worker process waiting for its pool to drain */
+#define FEED_INTERVAL_NS 1000000L
+
+/* ------------------ Declarations of internal functions ------------------ */
+
+static int split_root(ShardList *list, const char *root, int index, blkcnt_t *sum,
+                      RateLimit *iops, RateLimit *dirs, double deadline, int *expired);
+static int add_shard(ShardList *list, const char *path, int root, dev_t dev);
+static Region *map_region(ShardList *list, int n_roots, Shard **shards, char **paths,
+                          const RateLimit *iops, const RateLimit *dirs);
+static void run_child(const Options *opts, char **roots, int n_roots,
+                      Region *region, Shard *shards, char *paths);
+static int feed_pool(System *system, Region *region, Shard *shards, char *paths, blkcnt_t *sums);
+
+/* -------------------------- External functions -------------------------- */
+
+int run_sharded(const Options *opts, char **roots, int n_roots, blkcnt_t *sums, int *expired)
+{
+    ShardList list = { 0 };
+    RateLimit iops;
+    RateLimit dirs;
+    int split_expired = 0;
+    int status = 0;
+
+    /* One deadline for the whole scan, including the coordinator's part */
+    double deadline = opts->deadline > 0 ? monotonic_seconds() + opts->deadline : 0;
+
+    /* The top level of each argument is counted by the coordinator */
+    ratelimit_init(&iops, opts->max_iops);
+    ratelimit_init(&dirs, opts->max_dirs_per_sec);
+    for (int i = 0; i < n_roots && !split_expired; i++) {
+        if (split_root(&list, roots[i], i, &sums[i], &iops, &dirs, deadline, &split_expired) != 0) {
+            status = 1;
+        }
+    }
+
+    Shard *shards;
+    char *paths;
+    Region *region = map_region(&list, n_roots, &shards, &paths, &iops, &dirs);
+    size_t region_size = sizeof(Region) + n_roots * sizeof(atomic_long) +
+                         list.n * sizeof(Shard) + list.paths_len;
+    free(list.shards);
+    free(list.paths);
+    if (!region) {
+        return -1;
+    }
+    region->deadline = deadline;
+    atomic_store(&region->expired, split_expired);
+
+    /* Flush before forking so buffered output is not written twice */
+    fflush(stdout);
+    fflush(stderr);
+
+    /* Past the deadline the shards are left unread */
+    int n_started = 0;
+    for (int p = 0; p < opts->procs && !split_expired; p++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            break;
+        }
+        if (pid == 0) {
+            run_child(opts, roots, n_roots, region, shards, paths);
+        }
+        n_started++;
+    }
+
+    /* A failed fork only means fewer processes share the shards */
+    int crashed = 0;
+    for (int p = 0; p < n_started; p++) {
+        int wstatus;
+        if (wait(&wstatus) < 0) {
+            perror("wait");
+            crashed = 1;
+            break;
+        }
+        if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) == 2) {
+            crashed = 1;
+        }
+    }
+
+    if (n_started == 0 && !split_expired) {
+        munmap(region, region_size);
+        return -1;
+    }
+    if (crashed) {
+        fprintf(stderr, "mdu: a worker process failed, totals may be incomplete\n");
+    }
+
+    for (int i = 0; i < n_roots; i++) {
+        sums[i] += atomic_load(&region->sums[i]);
+    }
+    *expired = atomic_load(&region->expired);
+    if (*expired) {
+        fprintf(stderr, "mdu: deadline of %g s reached\n", opts->deadline);
+    }
+    if (crashed || atomic_load(&region->status) != 0) {
+        status = 1;
+    }
+
+    munmap(region, region_size);
+    return status;
+}
+
+/* -------------------------- Internal functions -------------------------- */
+
+/**
+ * split_root - Counts the top level of an argument and collects its subdirectories.
+ * @list: Shard list to add the subdirectories to.
+ * @root: Argument path.
+ * @index: Index of the argument.
+ * @sum: Block count of the argument, updated.
+ * @iops: Limiter for --max-iops.
+ * @dirs: Limiter for --max-dirs-per-sec.
+ * @deadline: Monotonic time in seconds when the scan expires, 0 for none.
+ * @expired: Set to 1 if the deadline stopped the scan.
+ *
+ * Return: 0 on success, -1 if some entry could not be read.
+ */
+static int split_root(ShardList *list, const char *root, int index, blkcnt_t *sum,
+                      RateLimit *iops, RateLimit *dirs, double deadline, int *expired)
+{
+    char path[PATH_MAX];
+    int iops_tokens = 0;
+    int dir_tokens = 0;
+    int ret = 0;
+
+    ratelimit_acquire(dirs, &dir_tokens);
+    ratelimit_acquire(iops, &iops_tokens);
+    DIR *dir = opendir(root);
+    if (!dir) {
+        perror("opendir");
+        return -1;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        snprintf(path, PATH_MAX, "%s/%s", root, entry->d_name);
+        if (deadline > 0 && monotonic_seconds() >= deadline) {
+            *expired = 1;
+            break;
+        }
+        struct stat sb;
+        ratelimit_acquire(iops, &iops_tokens);
+        if (lstat(path, &sb) == -1) {
+            perror("lstat");
+            ret = -1;
+            continue;
+        }
+        *sum += sb.st_blocks;
+
+        if (S_ISDIR(sb.st_mode) && add_shard(list, path, index, sb.st_dev) != 0) {
+            ret = -1;
+            break;
+        }
+    }
+    if (closedir(dir) != 0) {
+        perror("closedir");
+        ret = -1;
+    }
+    return ret;
+}
+
+/**
+ * add_shard - Appends a shard to the list.
+ * @list: Shard list.
+ * @path: Path of the directory.
+ * @root: Index of the argument.
+ * @dev: Device of the directory.
+ *
+ * Return: 0 on success, -1 on failure.
+ */
+static int add_shard(ShardList *list, const char *path, int root, dev_t dev)
+{
+    size_t len = strlen(path) + 1;
+
+    if (list->n == list->cap) {
+        long cap = list->cap ? list->cap * 2 : 64;
+        Shard *shards = realloc(list->shards, cap * sizeof(Shard));
+        if (!shards) {
+            perror("realloc");
+            return -1;
+        }
+        list->shards = shards;
+        list->cap = cap;
+    }
+    if (list->paths_len + len > list->paths_cap) {
+        size_t cap = list->paths_cap * 2 + len + 4096;
+        char *paths = realloc(list->paths, cap);
+        if (!paths) {
+            perror("realloc");
+            return -1;
+        }
+        list->paths = paths;
+        list->paths_cap = cap;
+    }
+
+    memcpy(list->paths + list->paths_len, path, len);
+    list->shards[list->n++] = (Shard){ .root = root, .dev = dev, .path = list->paths_len };
+    list->paths_len += len;
+    return 0;
+}
+
+/**
+ * map_region - Creates the shared region and copies the shards into it.
+ * @list: Collected shards.
+ * @n_roots: Number of arguments.
+ * @shards: Set to the shard array inside the region.
+ * @paths: Set to the string area inside the region.
+ * @iops: Limiter for --max-iops as the coordinator left it.
+ * @dirs: Limiter for --max-dirs-per-sec as the coordinator left it.
+ *
+ * Return: Pointer to the region, or NULL on failure.
+ */
+static Region *map_region(ShardList *list, int n_roots, Shard **shards, char **paths,
+                          const RateLimit *iops, const RateLimit *dirs)
+{
+    size_t sums_size = n_roots * sizeof(atomic_long);
+    size_t size = sizeof(Region) + sums_size + list->n * sizeof(Shard) + list->paths_len;
+
+    Region *region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    atomic_init(&region->next, 0);
+    region->n_shards = list->n;
+    atomic_init(&region->expired, 0);
+    atomic_init(&region->status, 0);
+
+    /* Time the coordinator already spent is carried over to the processes */
+    region->iops.interval_ns = iops->interval_ns;
+    region->iops.batch = iops->batch;
+    atomic_init(&region->iops.tat, atomic_load(&iops->tat));
+    region->dirs.interval_ns = dirs->interval_ns;
+    region->dirs.batch = dirs->batch;
+    atomic_init(&region->dirs.tat, atomic_load(&dirs->tat));
+    for (int i = 0; i < n_roots; i++) {
+        atomic_init(&region->sums[i], 0);
+    }
+
+    *shards = (Shard *)((char *)region + sizeof(Region) + sums_size);
+    *paths = (char *)(*shards + list->n);
+    if (list->n > 0) {
+        memcpy(*shards, list->shards, list->n * sizeof(Shard));
+        memcpy(*paths, list->paths, list->paths_len);
+    }
+    return region;
+}
+
+/**
+ * run_child - Body of a worker process. Never returns.
+ * @opts: Command-line options.
+ * @roots: Paths given as arguments.
+ * @n_roots: Number of arguments.
+ * @region: Shared region.
+ * @shards: Shard array in the region.
+ * @paths: String area in the region.
+ *
+ * Exits with 0 on success, 1 if some path could not be read and 2 on a
+ * critical failure.
+ */
+static void run_child(const Options *opts, char **roots, int n_roots,
+                      Region *region, Shard *shards, char *paths)
+{
+    Options child_opts = *opts;
+    child_opts.procs = 0;
+    child_opts.progress = 0;
+
+    pthread_t threads[child_opts.n_threads];
+    System system;
+    blkcnt_t *sums = calloc(n_roots, sizeof(blkcnt_t));
+    if (!sums || system_init(&system, &child_opts) != 0) {
+        _exit(2);
+    }
+    if (system_set_roots(&system, roots, n_roots) != 0) {
+        _exit(2);
+    }
+
+    /* The limits are for the whole scan, so all processes draw from one bucket */
+    system.iops = &region->iops;
+    system.dirs = &region->dirs;
+
+    Monitor monitor;
+    if (monitor_start_until(&monitor, &system, region->deadline) != 0 ||
+        system_start(&system, threads) != 0) {
+        _exit(2);
+    }
+
+    int ret = feed_pool(&system, region, shards, paths, sums);
+    system_join(&system, threads);
+    if (monitor_stop(&monitor) != 0) {
+        ret = -1;
+    }
+
+    for (int i = 0; i < n_roots; i++) {
+        atomic_fetch_add(&region->sums[i], sums[i]);
+    }
+    if (atomic_load(&system.expired)) {
+        atomic_store(&region->expired, 1);
+    }
+    if (system.status != 0 || ret != 0) {
+        atomic_store(&region->status, 1);
+    }
+
+    int status = ret != 0 || system.status == 2 ? 2 : 0;
+    system_destroy(&system);
+    free(sums);
+    _exit(status);
+}
+
+/**
+ * feed_pool - Claims shards and hands them to the local pool.
+ * @system: Pointer to the local system.
+ * @region: Shared region.
+ * @shards: Shard array in the region.
+ * @paths: String area in the region.
+ * @sums: Local per-argument totals.
+ *
+ * A shard is only claimed when the local queue runs low, so shards stay
+ * available to processes that finish their work earlier.
+ *
+ * Return: 0 on success, -1 on failure.
+ */
+static int feed_pool(System *system, Region *region, Shard *shards, char *paths, blkcnt_t *sums)
+{
+    const struct timespec interval = { 0, FEED_INTERVAL_NS };
+
+    while (!atomic_load_explicit(&system->expired, memory_order_relaxed)) {
+        if (atomic_load_explicit(&system->pending, memory_order_relaxed) >= system->n_threads) {
+            nanosleep(&interval, NULL);
+            continue;
+        }
+
+        long i = atomic_fetch_add(&region->next, 1);
+        if (i >= region->n_shards) {
+            return 0;
+        }
+
+        Task *task = malloc(sizeof(Task));
+        if (!task) {
+            perror("malloc task");
+            return -1;
+        }
+        strlcpy(task->path, paths + shards[i].path, PATH_MAX);
+        task->sum = &sums[shards[i].root];
+        task->root = shards[i].root;
+        task->dev = shards[i].dev;
+        task->weight = 1.0;
+        task->estimate = 0.0;
+        task->priority = 0.0;
+        task->rec = SNAP_NONE;
+        task->parent = SNAP_NONE;
+        task->depth = 0;
+
+        if (system_enqueue(system, task) != 0) {
+            free(task);
+            return -1;
+        }
+    }
+    return 0;
+}
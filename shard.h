@@ -0,0 +1,30 @@
+/**
+ * shard.h - Header for multi-process sharded scanning.
+ *
+ * A coordinator splits the arguments into top-level directory shards and
+ * forks worker processes that each run their own System pool. Shards and
+ * results are exchanged through an anonymous shared memory region.
+ *
+ * Author: Rasmus Mikaelsson (et24rmn)
+ * Version: 12-01-2026
+ */
+
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <sys/types.h>
+#include "system.h"
+
+/**
+ * run_sharded - Scans the arguments with opts->procs worker processes.
+ * @opts: Command-line options; every process runs opts->n_threads threads.
+ * @roots: Paths given as arguments.
+ * @n_roots: Number of arguments.
+ * @sums: Array of @n_roots block counts to store the merged totals in.
+ * @expired: Set to non-zero if any process hit the deadline.
+ *
+ * Return: 0 on success, 1 if some path could not be read, -1 on failure.
+ */
+int run_sharded(const Options *opts, char **roots, int n_roots, blkcnt_t *sums, int *expired);
+
+#endif
@@ -0,0 +1,472 @@
+/**
+ * snapshot.c - Per-directory totals, saved as a sorted index and diffed.
+ *
+ * A record id is the worker index in the high bits and the position in
+ * that worker's log in the low bits, so records can point at their parent
+ * across workers without any shared counter. After the scan the records
+ * are laid out in one array and every directory's total is added to its
+ * parent's, deepest level first, which takes one pass after a counting
+ * sort by depth.
+ *
+ * The file holds a header, the entries sorted by (hash, path) and a
+ * string table. Sorting is an LSD radix sort on the hash, so building,
+ * saving and diffing are all linear in the number of directories.
+ *
+ * Author: Rasmus Mikaelsson (et24rmn)
+ * Version: 12-01-2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+
+/* Bits of a record id that hold the position in the worker's log */
+#define ID_SHIFT 40
+#define ID_MASK ((UINT64_C(1) << ID_SHIFT) - 1)
+
+/* Initial capacities of a log */
+#define LOG_MIN_RECS 64
+#define LOG_MIN_NAMES 4096
+
+/* Identifies a snapshot file and its layout version */
+#define SNAP_MAGIC "MDUSNAP1"
+
+/**
+ * struct SnapHeader - Start of a snapshot file.
+ * @magic: SNAP_MAGIC without its NUL.
+ * @n: Number of entries following the header.
+ * @strings_len: Bytes of the string table following the entries.
+ */
+typedef struct SnapHeader {
+    char magic[8];
+    uint64_t n;
+    uint64_t strings_len;
+} SnapHeader;
+
+/* ------------------ Declarations of internal functions ------------------ */
+
+static uint64_t hash_path(const char *path);
+static SnapEntry *radix_sort(SnapEntry *items, SnapEntry *tmp, size_t n);
+static int compare_entries(const SnapEntry *a, const char *a_strings,
+                           const SnapEntry *b, const char *b_strings);
+static void keep_top(DiffRow *rows, int *n, int top, int64_t delta, const char *path);
+
+/* -------------------------- External functions -------------------------- */
+
+int dirlog_add(DirLog *log, const char *path, uint64_t parent, int depth, uint64_t *id) {
+    if (log->len == log->cap) {
+        size_t cap = log->cap ? log->cap * 2 : LOG_MIN_RECS;
+        DirRecord *recs = realloc(log->recs, cap * sizeof(DirRecord));
+        if (!recs) {
+            perror("realloc");
+            return -1;
+        }
+        log->recs = recs;
+        log->cap = cap;
+    }
+
+    size_t len = strlen(path) + 1;
+    if (log->names_len + len > log->names_cap) {
+        size_t cap = log->names_cap ? log->names_cap : LOG_MIN_NAMES;
+        while (cap < log->names_len + len) {
+            cap *= 2;
+        }
+        char *names = realloc(log->names, cap);
+        if (!names) {
+            perror("realloc");
+            return -1;
+        }
+        log->names = names;
+        log->names_cap = cap;
+    }
+    memcpy(log->names + log->names_len, path, len);
+
+    log->recs[log->len] = (DirRecord){ .parent = parent, .blocks = 0,
+                                       .path = log->names_len, .depth = depth };
+    log->names_len += len;
+    *id = ((uint64_t)log->worker << ID_SHIFT) | log->len++;
+    return 0;
+}
+
+void dirlog_set(DirLog *log, uint64_t id, int64_t blocks) {
+    log->recs[id & ID_MASK].blocks = blocks;
+}
+
+void dirlog_free(DirLog *log) {
+    free(log->recs);
+    free(log->names);
+    *log = (DirLog){ .worker = log->worker };
+}
+
+int snapshot_build(Snapshot *snap, const DirLog *logs, int n_logs) {
+    *snap = (Snapshot){ 0 };
+
+    /* Records of worker w start at offsets[w] in the combined array */
+    size_t *offsets = malloc((n_logs + 1) * sizeof(size_t));
+    if (!offsets) {
+        perror("malloc");
+        return -1;
+    }
+    size_t n = 0;
+    int max_depth = 0;
+    for (int w = 0; w < n_logs; w++) {
+        offsets[w] = n;
+        n += logs[w].len;
+        for (size_t i = 0; i < logs[w].len; i++) {
+            if (logs[w].recs[i].depth > max_depth) {
+                max_depth = logs[w].recs[i].depth;
+            }
+        }
+    }
+    offsets[n_logs] = n;
+
+    int64_t *totals = malloc(n * sizeof(int64_t) + 1);
+    size_t *parents = malloc(n * sizeof(size_t) + 1);
+    const char **paths = malloc(n * sizeof(char *) + 1);
+    size_t *order = malloc(n * sizeof(size_t) + 1);
+    size_t *count = calloc(max_depth + 2, sizeof(size_t));
+    SnapEntry *entries = malloc(n * sizeof(SnapEntry) + 1);
+    SnapEntry *tmp = malloc(n * sizeof(SnapEntry) + 1);
+    SnapEntry *sorted = NULL;
+    int ret = -1;
+    if (!totals || !parents || !paths || !order || !count || !entries || !tmp) {
+        perror("malloc");
+        goto out;
+    }
+
+    size_t strings_len = 0;
+    for (int w = 0; w < n_logs; w++) {
+        for (size_t i = 0; i < logs[w].len; i++) {
+            const DirRecord *rec = &logs[w].recs[i];
+            size_t g = offsets[w] + i;
+            totals[g] = rec->blocks;
+            parents[g] = rec->parent == SNAP_NONE ? SIZE_MAX
+                       : offsets[rec->parent >> ID_SHIFT] + (rec->parent & ID_MASK);
+            paths[g] = logs[w].names + rec->path;
+            strings_len += strlen(paths[g]) + 1;
+            count[rec->depth + 1]++;
+        }
+    }
+
+    /* Counting sort by depth, then fold each level into the one above */
+    for (int d = 0; d <= max_depth; d++) {
+        count[d + 1] += count[d];
+    }
+    for (int w = 0; w < n_logs; w++) {
+        for (size_t i = 0; i < logs[w].len; i++) {
+            order[count[logs[w].recs[i].depth]++] = offsets[w] + i;
+        }
+    }
+    for (size_t k = n; k-- > 0;) {
+        size_t g = order[k];
+        if (parents[g] != SIZE_MAX) {
+            totals[parents[g]] += totals[g];
+        }
+    }
+
+    /* Sort by hash; the rare equal hashes are ordered by path */
+    for (size_t g = 0; g < n; g++) {
+        entries[g] = (SnapEntry){ .hash = hash_path(paths[g]), .blocks = totals[g], .path = g };
+    }
+    sorted = radix_sort(entries, tmp, n);
+    for (size_t i = 1; i < n; i++) {
+        SnapEntry e = sorted[i];
+        size_t j = i;
+        while (j > 0 && sorted[j - 1].hash == e.hash && strcmp(paths[sorted[j - 1].path], paths[e.path]) > 0) {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = e;
+    }
+
+    /* Lay out the string table in entry order, dropping repeated arguments */
+    snap->strings = malloc(strings_len + 1);
+    if (!snap->strings) {
+        perror("malloc");
+        goto out;
+    }
+    size_t pos = 0, m = 0;
+    for (size_t i = 0; i < n; i++) {
+        const char *path = paths[sorted[i].path];
+        if (m > 0 && sorted[i].hash == sorted[m - 1].hash && strcmp(path, snap->strings + sorted[m - 1].path) == 0) {
+            continue;
+        }
+        size_t len = strlen(path) + 1;
+        memcpy(snap->strings + pos, path, len);
+        sorted[m] = sorted[i];
+        sorted[m++].path = pos;
+        pos += len;
+    }
+
+    snap->entries = sorted;
+    snap->n = m;
+    ret = 0;
+
+out:
+    if (ret != 0 || sorted != entries) {
+        free(entries);
+    }
+    if (ret != 0 || sorted != tmp) {
+        free(tmp);
+    }
+    free(offsets);
+    free(totals);
+    free(parents);
+    free(paths);
+    free(order);
+    free(count);
+    return ret;
+}
+
+int snapshot_save(const Snapshot *snap, const char *file) {
+    char tmp[PATH_MAX];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", file) >= (int)sizeof(tmp)) {
+        fprintf(stderr, "%s: path too long\n", file);
+        return -1;
+    }
+
+    size_t strings_len = 0;
+    if (snap->n > 0) {
+        const char *last = snap->strings + snap->entries[snap->n - 1].path;
+        strings_len = last + strlen(last) + 1 - snap->strings;
+    }
+
+    FILE *out = fopen(tmp, "wb");
+    if (!out) {
+        perror(tmp);
+        return -1;
+    }
+    SnapHeader header = { .n = snap->n, .strings_len = strings_len };
+    memcpy(header.magic, SNAP_MAGIC, sizeof(header.magic));
+
+    int ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+             fwrite(snap->entries, sizeof(SnapEntry), snap->n, out) == snap->n &&
+             fwrite(snap->strings, 1, strings_len, out) == strings_len;
+    if (fclose(out) != 0) {
+        ok = 0;
+    }
+    if (!ok || rename(tmp, file) != 0) {
+        perror(file);
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+int snapshot_load(Snapshot *snap, const char *file) {
+    *snap = (Snapshot){ 0 };
+
+    int fd = open(file, O_RDONLY);
+    if (fd < 0) {
+        perror(file);
+        return -1;
+    }
+    struct stat sb;
+    if (fstat(fd, &sb) != 0) {
+        perror(file);
+        close(fd);
+        return -1;
+    }
+    if ((size_t)sb.st_size < sizeof(SnapHeader)) {
+        fprintf(stderr, "%s: not a snapshot\n", file);
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror(file);
+        return -1;
+    }
+    snap->map = map;
+    snap->map_len = sb.st_size;
+
+    /* Check the layout before anything points into it */
+    const SnapHeader *header = map;
+    size_t body = snap->map_len - sizeof(SnapHeader);
+    int ok = memcmp(header->magic, SNAP_MAGIC, sizeof(header->magic)) == 0 &&
+             header->n <= body / sizeof(SnapEntry) &&
+             header->strings_len == body - header->n * sizeof(SnapEntry);
+    if (ok) {
+        snap->entries = (SnapEntry *)(header + 1);
+        snap->n = header->n;
+        snap->strings = (char *)(snap->entries + snap->n);
+        ok = header->strings_len == 0 || snap->strings[header->strings_len - 1] == '\0';
+        for (size_t i = 0; ok && i < snap->n; i++) {
+            ok = snap->entries[i].path < header->strings_len;
+        }
+    }
+    if (!ok) {
+        fprintf(stderr, "%s: not a snapshot\n", file);
+        snapshot_free(snap);
+        return -1;
+    }
+    return 0;
+}
+
+int64_t snapshot_lookup(const Snapshot *snap, const char *path) {
+    uint64_t hash = hash_path(path);
+    size_t lo = 0, hi = snap->n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (snap->entries[mid].hash < hash) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    for (; lo < snap->n && snap->entries[lo].hash == hash; lo++) {
+        if (strcmp(snap->strings + snap->entries[lo].path, path) == 0) {
+            return snap->entries[lo].blocks;
+        }
+    }
+    return -1;
+}
+
+void snapshot_diff(const Snapshot *old, const Snapshot *new, int top,
+                   DiffRow *grown, int *n_grown, DiffRow *shrunk, int *n_shrunk) {
+    size_t i = 0, j = 0;
+    *n_grown = 0;
+    *n_shrunk = 0;
+
+    while (i < old->n || j < new->n) {
+        int c = i == old->n ? 1 : j == new->n ? -1
+              : compare_entries(&old->entries[i], old->strings, &new->entries[j], new->strings);
+        int64_t delta;
+        const char *path;
+
+        if (c < 0) {
+            /* Gone since the old snapshot */
+            delta = -old->entries[i].blocks;
+            path = old->strings + old->entries[i++].path;
+        } else if (c > 0) {
+            /* New since the old snapshot */
+            delta = new->entries[j].blocks;
+            path = new->strings + new->entries[j++].path;
+        } else {
+            delta = new->entries[j].blocks - old->entries[i++].blocks;
+            path = new->strings + new->entries[j++].path;
+        }
+
+        if (delta > 0) {
+            keep_top(grown, n_grown, top, delta, path);
+        } else if (delta < 0) {
+            keep_top(shrunk, n_shrunk, top, -delta, path);
+        }
+    }
+
+    for (int k = 0; k < *n_shrunk; k++) {
+        shrunk[k].delta = -shrunk[k].delta;
+    }
+}
+
+void snapshot_free(Snapshot *snap) {
+    if (snap->map) {
+        munmap(snap->map, snap->map_len);
+    } else {
+        free(snap->entries);
+        free(snap->strings);
+    }
+    *snap = (Snapshot){ 0 };
+}
+
+/* -------------------------- Internal functions -------------------------- */
+
+/**
+ * hash_path - 64-bit FNV-1a hash of a path.
+ * @path: NUL-terminated path.
+ *
+ * Return: Hash of @path.
+ */
+static uint64_t hash_path(const char *path) {
+    uint64_t h = UINT64_C(14695981039346656037);
+    for (const unsigned char *p = (const unsigned char *)path; *p; p++) {
+        h ^= *p;
+        h *= UINT64_C(1099511628211);
+    }
+    return h;
+}
+
+/**
+ * radix_sort - LSD radix sort of snapshot entries by hash.
+ * @items: Entries to sort.
+ * @tmp: Scratch array of the same size.
+ * @n: Number of entries.
+ *
+ * The sort is stable, which keeps equal hashes in record order.
+ *
+ * Return: @items or @tmp, whichever holds the sorted result.
+ */
+static SnapEntry *radix_sort(SnapEntry *items, SnapEntry *tmp, size_t n) {
+    for (int shift = 0; shift < 64; shift += 8) {
+        size_t count[256] = { 0 };
+        for (size_t i = 0; i < n; i++) {
+            count[(items[i].hash >> shift) & 0xff]++;
+        }
+        if (n == 0 || count[(items[0].hash >> shift) & 0xff] == n) {
+            continue;
+        }
+
+        size_t pos = 0;
+        for (int b = 0; b < 256; b++) {
+            size_t c = count[b];
+            count[b] = pos;
+            pos += c;
+        }
+        for (size_t i = 0; i < n; i++) {
+            tmp[count[(items[i].hash >> shift) & 0xff]++] = items[i];
+        }
+
+        SnapEntry *swap = items;
+        items = tmp;
+        tmp = swap;
+    }
+    return items;
+}
+
+/**
+ * compare_entries - Orders two entries by hash, then by path.
+ * @a: First entry.
+ * @a_strings: String table of @a.
+ * @b: Second entry.
+ * @b_strings: String table of @b.
+ *
+ * Return: Negative, zero or positive as @a sorts before, with or after @b.
+ */
+static int compare_entries(const SnapEntry *a, const char *a_strings,
+                           const SnapEntry *b, const char *b_strings) {
+    if (a->hash != b->hash) {
+        return a->hash < b->hash ? -1 : 1;
+    }
+    return strcmp(a_strings + a->path, b_strings + b->path);
+}
+
+/**
+ * keep_top - Inserts a row into a list of the largest deltas if it belongs there.
+ * @rows: Rows sorted by delta, largest first.
+ * @n: Number of rows, updated.
+ * @top: Capacity of @rows.
+ * @delta: Delta of the new row, positive.
+ * @path: Path of the new row.
+ *
+ * @top is small, so most rows are rejected by one comparison with the
+ * last kept row.
+ */
+static void keep_top(DiffRow *rows, int *n, int top, int64_t delta, const char *path) {
+    if (top <= 0 || (*n == top && rows[top - 1].delta >= delta)) {
+        return;
+    }
+    int i = *n < top ? (*n)++ : top - 1;
+    while (i > 0 && rows[i - 1].delta < delta) {
+        rows[i] = rows[i - 1];
+        i--;
+    }
+    rows[i] = (DiffRow){ delta, path };
+}
@@ -0,0 +1,184 @@
+/**
+ * snapshot.h - Per-directory totals, saved as a sorted index and diffed.
+ *
+ * While scanning, each worker appends one record per directory to its own
+ * DirLog, so logging needs no locking. Once all workers have been joined
+ * the logs are turned into a Snapshot: recursive totals are summed from
+ * the deepest directories up, and the directories are sorted by path hash.
+ * A snapshot is written as one flat file that can be mapped back as is,
+ * and two snapshots are compared by a single merge of their sorted arrays.
+ *
+ * Author: Rasmus Mikaelsson (et24rmn)
+ * Version: 12-01-2026
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Record id of a directory whose parent was not scanned (an argument) */
+#define SNAP_NONE UINT64_MAX
+
+/**
+ * struct DirRecord - One directory read by a worker.
+ * @parent: Record id of the parent directory, SNAP_NONE for an argument.
+ * @blocks: Blocks of the directory's entries, not counting subdirectory contents.
+ * @path: Offset of the path in DirLog.names.
+ * @depth: Depth below the argument, 0 for the argument itself.
+ */
+typedef struct DirRecord {
+    uint64_t parent;
+    int64_t blocks;
+    size_t path;
+    int depth;
+} DirRecord;
+
+/**
+ * struct DirLog - Directories read by one worker.
+ * @worker: Index of the worker, part of every record id it hands out.
+ * @recs: Records in the order the directories were opened.
+ * @len: Number of records.
+ * @cap: Capacity of @recs.
+ * @names: Packed, NUL-terminated paths.
+ * @names_len: Bytes used in @names.
+ * @names_cap: Capacity of @names in bytes.
+ */
+typedef struct DirLog {
+    int worker;
+    DirRecord *recs;
+    size_t len;
+    size_t cap;
+    char *names;
+    size_t names_len;
+    size_t names_cap;
+} DirLog;
+
+/**
+ * struct SnapEntry - One directory of a snapshot, as stored in the file.
+ * @hash: FNV-1a hash of the path, the sort key.
+ * @blocks: Recursive block total of the directory.
+ * @path: Offset of the path in the string table.
+ */
+typedef struct SnapEntry {
+    uint64_t hash;
+    int64_t blocks;
+    uint64_t path;
+} SnapEntry;
+
+/**
+ * struct Snapshot - Directories sorted by (hash, path).
+ * @entries: Sorted entries.
+ * @n: Number of entries.
+ * @strings: String table the entries point into.
+ * @map: Mapping of the file if loaded with snapshot_load(), otherwise NULL.
+ * @map_len: Length of @map.
+ */
+typedef struct Snapshot {
+    SnapEntry *entries;
+    size_t n;
+    char *strings;
+    void *map;
+    size_t map_len;
+} Snapshot;
+
+/**
+ * struct DiffRow - A directory whose total changed between two snapshots.
+ * @delta: New total minus old total, in blocks.
+ * @path: Path of the directory, owned by one of the snapshots.
+ */
+typedef struct DiffRow {
+    int64_t delta;
+    const char *path;
+} DiffRow;
+
+/**
+ * Logs a directory that is about to be read.
+ *
+ * @param log		Log of the calling worker
+ * @param path		Path of the directory
+ * @param parent	Record id of its parent, SNAP_NONE for an argument
+ * @param depth		Depth below the argument
+ * @param id		Set to the record id of the directory
+ * @return			0 on success, -1 on failure
+ */
+int dirlog_add(DirLog *log, const char *path, uint64_t parent, int depth, uint64_t *id);
+
+/**
+ * Sets the block count of a logged directory once it has been read.
+ *
+ * @param log		Log the directory was added to
+ * @param id		Record id returned by dirlog_add()
+ * @param blocks	Blocks of the directory's entries
+ */
+void dirlog_set(DirLog *log, uint64_t id, int64_t blocks);
+
+/**
+ * Frees the log's memory and resets it to empty, keeping its worker index.
+ *
+ * @param log	Pointer to log
+ */
+void dirlog_free(DirLog *log);
+
+/**
+ * Builds a snapshot from the logs of all workers.
+ *
+ * @param snap		Snapshot to fill in, freed with snapshot_free()
+ * @param logs		Logs indexed by worker
+ * @param n_logs	Number of logs
+ * @return			0 on success, -1 on failure
+ */
+int snapshot_build(Snapshot *snap, const DirLog *logs, int n_logs);
+
+/**
+ * Writes a snapshot to a file, replacing it atomically.
+ *
+ * @param snap	Snapshot to write
+ * @param file	Path of the file
+ * @return		0 on success, -1 on failure
+ */
+int snapshot_save(const Snapshot *snap, const char *file);
+
+/**
+ * Maps a snapshot file written by snapshot_save().
+ *
+ * @param snap	Snapshot to fill in, freed with snapshot_free()
+ * @param file	Path of the file
+ * @return		0 on success, -1 if the file cannot be read or is not a snapshot
+ */
+int snapshot_load(Snapshot *snap, const char *file);
+
+/**
+ * Looks up the total of a directory.
+ *
+ * @param snap	Snapshot to search
+ * @param path	Path of the directory
+ * @return		Recursive block total, or -1 if the directory is not in @snap
+ */
+int64_t snapshot_lookup(const Snapshot *snap, const char *path);
+
+/**
+ * Finds the directories that grew and shrank the most between two snapshots.
+ * Directories present in only one of them count as grown from or shrunk
+ * to zero. Runs in one pass over both snapshots.
+ *
+ * @param old		Earlier snapshot
+ * @param new		Later snapshot
+ * @param top		Rows wanted in each of @grown and @shrunk
+ * @param grown		Filled with up to @top rows, largest growth first
+ * @param n_grown	Set to the number of rows in @grown
+ * @param shrunk	Filled with up to @top rows, largest shrink first
+ * @param n_shrunk	Set to the number of rows in @shrunk
+ */
+void snapshot_diff(const Snapshot *old, const Snapshot *new, int top,
+                   DiffRow *grown, int *n_grown, DiffRow *shrunk, int *n_shrunk);
+
+/**
+ * Frees or unmaps a snapshot and resets it to empty.
+ *
+ * @param snap	Pointer to snapshot
+ */
+void snapshot_free(Snapshot *snap);
+
+#endif
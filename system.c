@@ -13,10 +13,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <linux/limits.h>
 
 #include "system.h"
 #include "queue.h"
+#include "sched.h"
 #include "worker.h"
 
 /* ------------------ Declarations of internal functions ------------------ */
@@ -30,6 +34,7 @@ static int init_cond(pthread_cond_t *cond);
 static int init_mutex(pthread_mutex_t *lock);
 static int destroy_cond(pthread_cond_t *cond);
 static int destroy_mutex(pthread_mutex_t *lock);
+static double task_priority(const void *task);
 
 /* -------------------------- External functions -------------------------- */
 
@@ -40,14 +45,16 @@ int system_enqueue(System *system, Task *task)
 		return -1;
 	}
 
-	if(enqueue(system->queue, task) != 0) {
+	if(sched_push(system->sched, task->dev, task) != 0) {
 		if(unlock_mutex(system->lock) != 0) {
 			return -1;
 		}
 		return -1;
 	}
-    
-	if(signal_cond(system->cond) != 0) {
+	atomic_fetch_add_explicit(&system->pending, 1, memory_order_relaxed);
+
+	/* Only pay for a wakeup when a worker is actually parked */
+	if(system->idle > 0 && signal_cond(system->cond) != 0) {
 		if(unlock_mutex(system->lock) != 0) {
 		    return -1;
 		}
@@ -63,7 +70,169 @@ int system_enqueue(System *system, Task *task)
 	return 0;
 }
 
-int system_join(System *system, pthread_t *threads, int n_threads)
+int system_enqueue_batch(System *system, Queue *tasks)
+{
+	if(is_empty(tasks)) {
+		return 0;
+	}
+
+	if(lock_mutex(system->lock) != 0) {
+		return -1;
+	}
+
+	dev_t dev = ((Task *)peek(tasks))->dev;
+	int n = sched_append(system->sched, dev, tasks);
+	if(n < 0) {
+		unlock_mutex(system->lock);
+		return -1;
+	}
+	atomic_fetch_add_explicit(&system->pending, n, memory_order_relaxed);
+
+	/* Wake one parked worker per new task, or all of them if outnumbered */
+	int ret = 0;
+	if(system->idle > 0 && n >= system->idle) {
+		ret = broadcast_cond(system->cond);
+	} else {
+		for(int i = 0; i < n && i < system->idle && ret == 0; i++) {
+			ret = signal_cond(system->cond);
+		}
+	}
+
+	if(unlock_mutex(system->lock) != 0) {
+		return -1;
+	}
+	return ret;
+}
+
+double monotonic_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int system_set_roots(System *system, char **roots, int n_roots)
+{
+	system->roots = roots;
+	system->n_roots = n_roots;
+
+	/* Tasks are scheduled by device, so note where each argument lives */
+	system->root_devs = calloc(n_roots, sizeof(dev_t));
+	if(!system->root_devs) {
+		perror("calloc");
+		return -1;
+	}
+	for(int i = 0; i < n_roots; i++) {
+		struct stat sb;
+		if(lstat(roots[i], &sb) == 0) {
+			system->root_devs[i] = sb.st_dev;
+		}
+	}
+
+	/* Histograms are sized per argument, one cache-aligned area per worker */
+	if(system->opts->histogram) {
+		system->hist_stride = (size_t)n_roots * HIST_KINDS * HIST_BUCKETS;
+		size_t bytes = (system->n_threads + 1) * system->hist_stride * sizeof(HistBucket);
+		system->hist = aligned_alloc(64, bytes);
+		if(!system->hist) {
+			perror("aligned_alloc");
+			return -1;
+		}
+		memset(system->hist, 0, bytes);
+		system->hist_now = time(NULL);
+	}
+
+	if(!system->opts->estimate) {
+		return 0;
+	}
+
+	system->estimates = calloc(n_roots, sizeof(Estimate));
+	if(!system->estimates) {
+		perror("calloc");
+		return -1;
+	}
+	for(int i = 0; i < n_roots; i++) {
+		system->estimates[i].started = system_probe_start(system);
+	}
+
+	system->estimate_end = monotonic_seconds() + system->opts->estimate_time;
+	return 0;
+}
+
+int system_probe_start(System *system)
+{
+	if(!system->opts->estimate) {
+		return 1;
+	}
+
+	/* One probe per worker keeps the pool busy, later probes chain on */
+	long probes = system->opts->estimate_probes;
+	if(probes > 0 && probes < system->n_threads) {
+		return (int)probes;
+	}
+	return system->n_threads;
+}
+
+int system_probe_done(System *system, Task *task)
+{
+	int expired = atomic_load_explicit(&system->expired, memory_order_relaxed) ||
+		(system->opts->estimate_time > 0 && monotonic_seconds() >= system->estimate_end);
+
+	if(lock_mutex(system->lock) != 0) {
+		return -1;
+	}
+
+	/* Welford update of the mean and variance of the probe totals */
+	Estimate *est = &system->estimates[task->root];
+	est->n++;
+	double delta = task->estimate - est->mean;
+	est->mean += delta / est->n;
+	est->m2 += delta * (task->estimate - est->mean);
+
+	long probes = system->opts->estimate_probes;
+	int again = !expired && (probes == 0 || est->started < probes);
+	if(again) {
+		est->started++;
+	}
+
+	if(unlock_mutex(system->lock) != 0) {
+		return -1;
+	}
+	return again;
+}
+
+int system_merge_usage(System *system, IdMap *users, IdMap *groups)
+{
+	for(int i = 0; i <= system->n_threads; i++) {
+		if(system->users && idmap_merge(users, &system->users[i]) != 0) {
+			return -1;
+		}
+		if(system->groups && idmap_merge(groups, &system->groups[i]) != 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+HistBucket *system_merge_histograms(System *system)
+{
+	HistBucket *merged = calloc(system->hist_stride, sizeof(HistBucket));
+	if(!merged) {
+		perror("calloc");
+		return NULL;
+	}
+
+	for(int i = 0; i <= system->n_threads; i++) {
+		HistBucket *hist = system->hist + i * system->hist_stride;
+		for(size_t b = 0; b < system->hist_stride; b++) {
+			merged[b].count += hist[b].count;
+			merged[b].blocks += hist[b].blocks;
+		}
+	}
+	return merged;
+}
+
+int system_join(System *system, pthread_t *threads)
 {
 	if(lock_mutex(system->lock) != 0) {
 		return -1;
@@ -81,7 +250,7 @@ int system_join(System *system, pthread_t *threads, int n_threads)
 	}
 
 	/* Join threads */
-    for (int i = 0; i < n_threads; i++) {
+    for (int i = 0; i < system->n_started; i++) {
         if(join_thread(threads[i], &system->status) != 0) {
 			return -1;
 		}
@@ -91,8 +260,10 @@ int system_join(System *system, pthread_t *threads, int n_threads)
     return 0;
 }
 
-int system_init(System *system, pthread_t *threads, int n_threads)
+int system_init(System *system, const Options *opts)
 {
+	int n_threads = opts->n_threads;
+
 	/* If any malloc failes, free successes and return -1 */ 
     pthread_cond_t *cond = malloc(sizeof(pthread_cond_t));
 	if(!cond) {
@@ -124,12 +295,24 @@ int system_init(System *system, pthread_t *threads, int n_threads)
 		return -1;
 	}
 
+    /* One slot per worker plus one for the main thread */
+    Counters *counters = aligned_alloc(_Alignof(Counters), (n_threads + 1) * sizeof(Counters));
+	if(!counters) {
+		perror("aligned_alloc");
+		free(cond);
+		free(lock);
+		free(done);
+		free(sum);
+		return -1;
+	}
+
 	/* Initialization of condition varible and mutex lock */
 	if(init_cond(cond) != 0) {
         free(cond);
 		free(lock);
 		free(done);
         free(sum);
+        free(counters);
 		return -1;
 	}
 
@@ -138,9 +321,16 @@ int system_init(System *system, pthread_t *threads, int n_threads)
 		free(lock);
 		free(done);
         free(sum);
+        free(counters);
 		return -1;
 	}
 
+    for (int i = 0; i <= n_threads; i++) {
+        atomic_init(&counters[i].entries, 0);
+        atomic_init(&counters[i].dirs, 0);
+        atomic_init(&counters[i].blocks, 0);
+    }
+
     *done = 0;
     *sum = 0;
 
@@ -148,22 +338,83 @@ int system_init(System *system, pthread_t *threads, int n_threads)
     system->lock = lock;
     system->done = done;
 	system->status = 0;
-    system->queue = create_queue();
-    if(!system->queue) {
+    system->idle = 0;
+    system->busy = 0;
+    atomic_init(&system->pending, 0);
+    system->spin = sysconf(_SC_NPROCESSORS_ONLN) > 1;
+    system->n_threads = n_threads;
+    system->opts = opts;
+    system->roots = NULL;
+    system->n_roots = 0;
+    system->estimates = NULL;
+    system->root_devs = NULL;
+    system->counters = counters;
+    atomic_init(&system->next_id, 0);
+    atomic_init(&system->expired, 0);
+    system->sched = sched_create(n_threads, opts->largest_first ? task_priority : NULL);
+    if(!system->sched) {
         free(cond);
 		free(lock);
 		free(done);
         free(sum);
+        free(counters);
         return -1;
     }
     system->sum = sum;
+    system->n_started = 0;
+    system->iops = &system->limits[0];
+    system->dirs = &system->limits[1];
+    ratelimit_init(system->iops, opts->max_iops);
+    ratelimit_init(system->dirs, opts->max_dirs_per_sec);
+    system->frontier_cap = 0;
+    if(opts->max_queue_mem > 0) {
+        /* At least one task may always be queued */
+        system->frontier_cap = opts->max_queue_mem < sizeof(Task) ? 1 : opts->max_queue_mem / sizeof(Task);
+    }
+
+    /* Owner and group maps are only allocated when asked for */
+    system->users = NULL;
+    system->groups = NULL;
+    system->hist = NULL;
+    system->hist_stride = 0;
+    if(opts->by_user) {
+        system->users = calloc(n_threads + 1, sizeof(IdMap));
+    }
+    if(opts->by_group) {
+        system->groups = calloc(n_threads + 1, sizeof(IdMap));
+    }
+    if((opts->by_user && !system->users) || (opts->by_group && !system->groups)) {
+        perror("calloc");
+        return -1;
+    }
 
+    /* Directory records are only kept for snapshots */
+    system->dirlogs = NULL;
+    system->prior = NULL;
+    if(opts->save || opts->diff) {
+        system->dirlogs = calloc(n_threads + 1, sizeof(DirLog));
+        if(!system->dirlogs) {
+            perror("calloc");
+            return -1;
+        }
+        for(int i = 0; i <= n_threads; i++) {
+            system->dirlogs[i].worker = i;
+        }
+    }
+
+	/* Return success */
+    return 0;
+}
+
+int system_start(System *system, pthread_t *threads)
+{
     /* Create worker threads */
-    for (int i = 0; i < n_threads; i++) {
+    for (int i = 0; i < system->n_threads; i++) {
         if (pthread_create(&threads[i], NULL, worker, system) != 0) {
             fprintf(stderr, "pthread creation failed\n");
             return -1;
         }
+        system->n_started++;
     }
 
 	/* Return success */
@@ -172,7 +423,7 @@ int system_init(System *system, pthread_t *threads, int n_threads)
 
 int system_destroy(System *system)
 {
-    free_queue(system->queue);
+    sched_free(system->sched);
 
     /* Destroy mutexes and condition variable */
 	if(destroy_cond(system->cond) != 0) {
@@ -188,6 +439,24 @@ int system_destroy(System *system)
     free(system->lock);
     free(system->done);
     free(system->sum);
+    free(system->estimates);
+    free(system->root_devs);
+    free(system->counters);
+    for(int i = 0; i <= system->n_threads; i++) {
+        if(system->users) {
+            idmap_free(&system->users[i]);
+        }
+        if(system->groups) {
+            idmap_free(&system->groups[i]);
+        }
+        if(system->dirlogs) {
+            dirlog_free(&system->dirlogs[i]);
+        }
+    }
+    free(system->dirlogs);
+    free(system->users);
+    free(system->groups);
+    free(system->hist);
 
 	/* Return success */
     return 0;
@@ -340,3 +609,13 @@ static int destroy_mutex(pthread_mutex_t *lock) {
     }
     return 0;
 }
+
+/**
+ * task_priority - Scheduling key of a task under --largest-first.
+ * @task: Pointer to a Task.
+ *
+ * Return: Estimated blocks in the task's subtree.
+ */
+static double task_priority(const void *task) {
+    return ((const Task *)task)->priority;
+}
@@ -12,33 +12,208 @@
 #define SYSTEM_H
 
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
 #include <sys/types.h>
+#include <linux/limits.h>
 #include "queue.h"
+#include "sched.h"
+#include "idmap.h"
+#include "ratelimit.h"
+#include "snapshot.h"
 
+/**
+ * struct Options - Settings parsed from the command line.
+ * @n_threads: Number of worker threads.
+ * @estimate: Non-zero to estimate totals by random descent instead of a full scan.
+ * @estimate_probes: Probes per argument in estimate mode, 0 for no limit.
+ * @estimate_time: Time budget in seconds for estimate mode, 0 for no limit.
+ * @progress: Seconds between progress reports on stderr, 0 for none.
+ * @deadline: Seconds after which the scan is cut short, 0 for none.
+ * @inode_order: Non-zero to stat the entries of each directory in inode order.
+ * @procs: Number of worker processes, 0 to scan in this process only.
+ * @by_user: Non-zero to break block usage down by owner.
+ * @by_group: Non-zero to break block usage down by group.
+ * @histogram: Bit mask of the HIST_* histograms to compute, 0 for none.
+ * @max_iops: Metadata I/Os (stats and directory reads) per second, 0 for no limit.
+ * @max_dirs_per_sec: Directories read per second, 0 for no limit.
+ * @idle_io: Non-zero to run in the idle I/O scheduling class.
+ * @max_queue_mem: Bytes of queued directories before workers scan
+ *                 subdirectories themselves, 0 for no limit.
+ * @largest_first: Non-zero to take the directories with the largest
+ *                 estimated subtree first instead of in FIFO order.
+ * @save: File to save the per-directory totals to, NULL for none.
+ * @diff: Snapshot file to compare the per-directory totals with, NULL for none.
+ */
+typedef struct Options {
+    int n_threads;
+    int estimate;
+    long estimate_probes;
+    double estimate_time;
+    double progress;
+    double deadline;
+    int inode_order;
+    int procs;
+    int by_user;
+    int by_group;
+    int histogram;
+    double max_iops;
+    double max_dirs_per_sec;
+    int idle_io;
+    size_t max_queue_mem;
+    int largest_first;
+    const char *save;
+    const char *diff;
+} Options;
+
+/* Histogram kinds, used as bit masks in Options.histogram */
+enum { HIST_SIZE, HIST_ATIME, HIST_MTIME, HIST_KINDS };
+
+/* Log2 buckets per histogram: bucket k holds values in [2^(k-1), 2^k) */
+#define HIST_BUCKETS 64
+
+/**
+ * struct HistBucket - One histogram bucket.
+ * @count: Number of regular files in the bucket.
+ * @blocks: Blocks used by those files.
+ */
+typedef struct HistBucket {
+    uint64_t count;
+    int64_t blocks;
+} HistBucket;
+
+/**
+ * struct Counters - Live statistics of one worker, padded to a cache line.
+ * @entries: Directory entries stat'ed.
+ * @dirs: Directories read.
+ * @blocks: Blocks counted.
+ *
+ * Only the owning worker writes its counters and other threads only read
+ * them, so relaxed atomics are enough and no cache line is shared.
+ */
+typedef struct Counters {
+    _Alignas(64) atomic_long entries;
+    atomic_long dirs;
+    atomic_long blocks;
+} Counters;
+
+/**
+ * struct Task - A directory waiting to be processed.
+ * @path: Path of the directory.
+ * @sum: Block count of the argument the directory belongs to.
+ * @root: Index of that argument.
+ * @dev: Device the directory lives on.
+ * @weight: Estimate mode: product of the branching factors above @path.
+ * @estimate: Estimate mode: running total of the probe that reached @path.
+ * @priority: --largest-first: estimated blocks in the subtree under @path.
+ * @rec: --save/--diff: record id of @path once it is being read.
+ * @parent: --save/--diff: record id of the parent directory, SNAP_NONE for an argument.
+ * @depth: Depth of @path below its argument.
+ */
 typedef struct Task {
     char path[PATH_MAX];
     blkcnt_t *sum;
+    int root;
+    dev_t dev;
+    double weight;
+    double estimate;
+    double priority;
+    uint64_t rec;
+    uint64_t parent;
+    int depth;
 } Task;
 
+/**
+ * struct Estimate - Running statistics of the probes of one argument.
+ * @started: Number of probes started.
+ * @n: Number of probes finished.
+ * @mean: Mean of the finished probe totals.
+ * @m2: Sum of squared deviations from @mean (Welford).
+ */
+typedef struct Estimate {
+    long started;
+    long n;
+    double mean;
+    double m2;
+} Estimate;
+
 /**
  * struct System - Holds synchronization objects and shared program state.
  * @cond: Condition variable for worker synchronization.
  * @lock: Mutex protecting shared state.
  * @done: Flag indicating no more tasks will arrive.
- * @queue: Pointer to task queue.
+ * @sched: Per-device task queues.
  * @sum: Pointer to total block count.
+ * @idle: Number of workers parked on @cond, protected by @lock.
+ * @busy: Number of workers processing a batch, protected by @lock. A busy
+ *        worker may still enqueue subdirectories, so the pool only exits
+ *        once it is zero.
+ * @pending: Lock-free hint of the queue size, read by spinning workers.
+ * @spin: Non-zero if workers may spin before parking (more than one CPU).
+ * @n_threads: Number of worker threads in the pool.
+ * @n_started: Number of worker threads actually started.
+ * @opts: Command-line options.
+ * @roots: Paths given as arguments.
+ * @n_roots: Number of arguments.
+ * @root_devs: Device of each argument.
+ * @estimates: Estimate mode: per-argument probe statistics, protected by @lock.
+ * @estimate_end: Estimate mode: monotonic time in seconds when no new probes may start.
+ * @counters: Live statistics indexed by worker id, slot @n_threads is the main thread's.
+ * @next_id: Next worker id to hand out.
+ * @expired: Set once the deadline has passed; no new work is started after that.
+ * @users: Per-worker block usage by owner, indexed like @counters, NULL if off.
+ * @groups: Per-worker block usage by group, indexed like @counters, NULL if off.
+ * @hist: Per-worker histograms indexed like @counters, each starting on a
+ *        cache line, NULL if off.
+ * @hist_stride: Buckets per worker in @hist: n_roots * HIST_KINDS * HIST_BUCKETS.
+ * @hist_now: Wall-clock time ages are measured from.
+ * @iops: Limiter for --max-iops, shared by all workers.
+ * @dirs: Limiter for --max-dirs-per-sec, shared by all workers.
+ * @limits: Storage of @iops and @dirs, unless a worker process of
+ *          --procs points them at the limiters all processes share.
+ * @frontier_cap: Queued tasks allowed by --max-queue-mem, 0 for no limit.
+ * @dirlogs: Per-worker directory records for --save/--diff, indexed like
+ *           @counters, NULL if off.
+ * @prior: Snapshot whose totals order the tasks under --largest-first, NULL if none.
  */
 typedef struct System {
     pthread_cond_t *cond;
     pthread_mutex_t *lock;
     int *done;
-    Queue *queue;
+    Sched *sched;
     blkcnt_t *sum;
 	int status;
+    int idle;
+    int busy;
+    atomic_int pending;
+    int spin;
+    int n_threads;
+    int n_started;
+    const Options *opts;
+    char **roots;
+    int n_roots;
+    dev_t *root_devs;
+    Estimate *estimates;
+    double estimate_end;
+    Counters *counters;
+    atomic_int next_id;
+    atomic_int expired;
+    IdMap *users;
+    IdMap *groups;
+    HistBucket *hist;
+    size_t hist_stride;
+    time_t hist_now;
+    RateLimit *iops;
+    RateLimit *dirs;
+    RateLimit limits[2];
+    long frontier_cap;
+    DirLog *dirlogs;
+    const Snapshot *prior;
 } System;
 
 /**
- * system_enqueue - Enqueues a task and signals a waiting worker thread.
+ * system_enqueue - Enqueues a task and wakes a worker if one is parked.
  * @system: Pointer to the system structure.
  * @task: Pointer to the task to enqueue.
  *
@@ -46,25 +221,97 @@ typedef struct System {
  */
 int system_enqueue(System *system, Task *task);
 
+/**
+ * system_enqueue_batch - Publishes a private queue of tasks in one critical section.
+ * @system: Pointer to the system structure.
+ * @tasks: Queue of tasks built by the caller, all on the same device;
+ *         left empty on success.
+ *
+ * Wakes at most as many parked workers as there are new tasks.
+ *
+ * Return: 0 on success, -1 on failure.
+ */
+int system_enqueue_batch(System *system, Queue *tasks);
+
+/**
+ * monotonic_seconds - Reads the monotonic clock.
+ *
+ * Return: Seconds since an arbitrary fixed point.
+ */
+double monotonic_seconds(void);
+
+/**
+ * system_set_roots - Registers the argument paths before any task is enqueued.
+ * @system: Pointer to the system structure.
+ * @roots: Paths given as arguments.
+ * @n_roots: Number of arguments.
+ *
+ * Return: 0 on success, -1 on failure.
+ */
+int system_set_roots(System *system, char **roots, int n_roots);
+
+/**
+ * system_probe_start - Number of tasks to enqueue per argument at start.
+ * @system: Pointer to the system structure.
+ *
+ * Return: 1 for a full scan, the initial number of probes in estimate mode.
+ */
+int system_probe_start(System *system);
+
+/**
+ * system_probe_done - Records a finished probe and decides whether to start another.
+ * @system: Pointer to the system structure.
+ * @task: Last task of the probe, holding its total in @task->estimate.
+ *
+ * Return: 1 if a new probe should start from the argument, 0 if not, -1 on failure.
+ */
+int system_probe_done(System *system, Task *task);
+
+/**
+ * system_merge_usage - Merges the per-worker owner and group maps.
+ * @system: Pointer to the system structure, after system_join().
+ * @users: Zero-initialized map to merge owner usage into.
+ * @groups: Zero-initialized map to merge group usage into.
+ *
+ * Return: 0 on success, -1 on failure.
+ */
+int system_merge_usage(System *system, IdMap *users, IdMap *groups);
+
+/**
+ * system_merge_histograms - Sums the per-worker histograms.
+ * @system: Pointer to the system structure, after system_join().
+ *
+ * Return: Array of n_roots * HIST_KINDS * HIST_BUCKETS buckets to be
+ *         freed by the caller, or NULL on failure.
+ */
+HistBucket *system_merge_histograms(System *system);
+
 /**
  * system_join - Signals worker threads to terminate and joins them.
  * @system: Pointer to the system structure.
  * @threads: Array of worker thread identifiers.
- * @n_threads: Number of worker threads.
  *
  * Return: 0 on success, -1 on failure.
  */
-int system_join(System *system, pthread_t *threads, int n_threads);
+int system_join(System *system, pthread_t *threads);
 
 /**
- * system_init - Initializes system resources and creates worker threads.
+ * system_init - Initializes system resources without starting any thread.
  * @system: Pointer to the system structure to initialize.
- * @threads: Array to store created worker thread identifiers.
- * @n_threads: Number of worker threads to create.
+ * @opts: Command-line options, including the size of the pool.
+ *
+ * Return: 0 on success, -1 on failure.
+ */
+int system_init(System *system, const Options *opts);
+
+/**
+ * system_start - Creates the worker threads.
+ * @system: Pointer to the system structure.
+ * @threads: Array of system->n_threads entries to store thread identifiers.
  *
  * Return: 0 on success, -1 on failure.
  */
-int system_init(System *system, pthread_t *threads, int n_threads);
+int system_start(System *system, pthread_t *threads);
 
 /**
  * system_destroy - Frees all system resources and destroys synchronization primitives.
@@ -0,0 +1,233 @@
+/**
+ * bench_queue.c - Throughput of the task queue and of system_enqueue().
+ *
+ * Runs P producers and C consumers for P = C = 1, 2, 4 ... 128 over two
+ * setups and prints operations per second:
+ *
+ *   queue   A Queue behind one mutex and condition variable, the way the
+ *           pool used it before the scheduler.
+ *   system  system_enqueue() into a System whose consumers take batches
+ *           with sched_take() like worker() does, with the same idle
+ *           counting so wakeups behave as in a scan.
+ *
+ * No file system access is involved; every producer enqueues the same
+ * Task over and over, since the queues only store pointers.
+ *
+ * Usage: bench_queue [items]
+ *
+ * Author: Rasmus Mikaelsson (et24rmn)
+ * Version: 12-01-2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "../queue.h"
+#include "../system.h"
+
+/* Items moved per run when none are given */
+#define DEFAULT_ITEMS 200000
+
+/* Largest number of producers and of consumers */
+#define MAX_THREADS 128
+
+/**
+ * struct Bench - State shared by the threads of one run.
+ * @queue: Queue of the queue setup.
+ * @lock: Lock of the queue setup.
+ * @cond: Condition variable of the queue setup.
+ * @system: System of the system setup.
+ * @task: Item every producer enqueues.
+ * @per_producer: Items each producer enqueues.
+ * @total: Items enqueued over all producers.
+ * @consumed: Items taken so far.
+ */
+typedef struct Bench {
+    Queue *queue;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    System *system;
+    Task task;
+    long per_producer;
+    long total;
+    long consumed;
+} Bench;
+
+/* ------------------ Declarations of internal functions ------------------ */
+
+static double run(int threads, long items, void *(*producer)(void *), void *(*consumer)(void *),
+                  System *system);
+static void *queue_producer(void *arg);
+static void *queue_consumer(void *arg);
+static void *system_producer(void *arg);
+static void *system_consumer(void *arg);
+
+/* -------------------------- External functions -------------------------- */
+
+int main(int argc, char **argv)
+{
+    long items = argc > 1 && atol(argv[1]) > 0 ? atol(argv[1]) : DEFAULT_ITEMS;
+
+    printf("%-8s %8s %14s %14s\n", "threads", "items", "queue ops/s", "system ops/s");
+    for (int t = 1; t <= MAX_THREADS; t *= 2) {
+        Options opts = { 0 };
+        opts.n_threads = t;
+        System system;
+        if (system_init(&system, &opts) != 0) {
+            return EXIT_FAILURE;
+        }
+
+        double q = run(t, items, queue_producer, queue_consumer, NULL);
+        double s = run(t, items, system_producer, system_consumer, &system);
+        system_destroy(&system);
+        if (q < 0 || s < 0) {
+            return EXIT_FAILURE;
+        }
+        printf("%-8d %8ld %14.0f %14.0f\n", t, items, items / q, items / s);
+    }
+    return EXIT_SUCCESS;
+}
+
+/* -------------------------- Internal functions -------------------------- */
+
+/**
+ * run - Moves @items items with @threads producers and @threads consumers.
+ * @threads: Number of producers and of consumers.
+ * @items: Items to move, rounded down to a multiple of @threads.
+ * @producer: Producer thread function.
+ * @consumer: Consumer thread function.
+ * @system: System of the system setup, NULL for the queue setup.
+ *
+ * Return: Elapsed seconds, or -1 on failure.
+ */
+static double run(int threads, long items, void *(*producer)(void *), void *(*consumer)(void *),
+                  System *system)
+{
+    Bench bench = { 0 };
+    pthread_t producers[MAX_THREADS], consumers[MAX_THREADS];
+
+    bench.queue = create_queue();
+    bench.system = system;
+    bench.per_producer = items / threads;
+    bench.total = bench.per_producer * threads;
+    if (!bench.queue || pthread_mutex_init(&bench.lock, NULL) != 0 ||
+        pthread_cond_init(&bench.cond, NULL) != 0) {
+        fprintf(stderr, "bench setup failed\n");
+        return -1;
+    }
+
+    double start = monotonic_seconds();
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&consumers[i], NULL, consumer, &bench) != 0 ||
+            pthread_create(&producers[i], NULL, producer, &bench) != 0) {
+            fprintf(stderr, "pthread_create failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(producers[i], NULL);
+        pthread_join(consumers[i], NULL);
+    }
+    double elapsed = monotonic_seconds() - start;
+
+    free_queue(bench.queue);
+    pthread_mutex_destroy(&bench.lock);
+    pthread_cond_destroy(&bench.cond);
+    return elapsed;
+}
+
+/**
+ * queue_producer - Enqueues items on the locked Queue.
+ * @arg: Pointer to the Bench.
+ */
+static void *queue_producer(void *arg)
+{
+    Bench *bench = arg;
+    for (long i = 0; i < bench->per_producer; i++) {
+        pthread_mutex_lock(&bench->lock);
+        enqueue(bench->queue, &bench->task);
+        pthread_cond_signal(&bench->cond);
+        pthread_mutex_unlock(&bench->lock);
+    }
+    return NULL;
+}
+
+/**
+ * queue_consumer - Dequeues items from the locked Queue until all are taken.
+ * @arg: Pointer to the Bench.
+ */
+static void *queue_consumer(void *arg)
+{
+    Bench *bench = arg;
+    pthread_mutex_lock(&bench->lock);
+    while (bench->consumed < bench->total) {
+        if (dequeue(bench->queue)) {
+            bench->consumed++;
+            continue;
+        }
+        pthread_cond_wait(&bench->cond, &bench->lock);
+    }
+    pthread_cond_broadcast(&bench->cond);
+    pthread_mutex_unlock(&bench->lock);
+    return NULL;
+}
+
+/**
+ * system_producer - Enqueues items through system_enqueue().
+ * @arg: Pointer to the Bench.
+ */
+static void *system_producer(void *arg)
+{
+    Bench *bench = arg;
+    for (long i = 0; i < bench->per_producer; i++) {
+        if (system_enqueue(bench->system, &bench->task) != 0) {
+            exit(EXIT_FAILURE);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * system_consumer - Takes batches from the scheduler like worker() does.
+ * @arg: Pointer to the Bench.
+ */
+static void *system_consumer(void *arg)
+{
+    Bench *bench = arg;
+    System *system = bench->system;
+    Queue *batch = create_queue();
+    int dev = -1;
+
+    pthread_mutex_lock(system->lock);
+    while (bench->consumed < bench->total) {
+        if (dev >= 0) {
+            sched_done(system->sched, dev, 0, 0);
+            dev = -1;
+        }
+        if (sched_size(system->sched) == 0) {
+            system->idle++;
+            pthread_cond_wait(system->cond, system->lock);
+            system->idle--;
+            continue;
+        }
+        int n = sched_take(system->sched, batch, &dev);
+        atomic_fetch_sub_explicit(&system->pending, n, memory_order_relaxed);
+        bench->consumed += n;
+
+        /* Items are handled outside the lock, as tasks are in a scan */
+        pthread_mutex_unlock(system->lock);
+        while (dequeue(batch)) {
+        }
+        pthread_mutex_lock(system->lock);
+    }
+    if (dev >= 0) {
+        sched_done(system->sched, dev, 0, 0);
+    }
+    pthread_cond_broadcast(system->cond);
+    pthread_mutex_unlock(system->lock);
+    free_queue(batch);
+    return NULL;
+}
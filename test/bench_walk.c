@@ -0,0 +1,201 @@
+/**
+ * bench_walk.c - Per-entry cost of process_path() and walk_serial().
+ *
+ * Generates trees with few and with many entries per directory and scans
+ * each one on the calling thread, taking subdirectories back from the
+ * scheduler the way a worker does. The cache is warmed by a first pass
+ * and the best of several passes is reported, so the numbers are the CPU
+ * cost of the scan code and the stat calls rather than disk latency.
+ *
+ * Usage: bench_walk [directories] [passes]
+ *
+ * Author: Rasmus Mikaelsson (et24rmn)
+ * Version: 12-01-2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/limits.h>
+
+#include "../system.h"
+#include "../worker.h"
+#include "tree.h"
+
+/* Directories per tree and passes per setup when none are given */
+#define DEFAULT_DIRS 2000
+#define DEFAULT_PASSES 5
+
+/**
+ * struct Setup - One way of scanning a tree.
+ * @name: Name printed in the report.
+ * @serial: Non-zero to use walk_serial() instead of process_path().
+ * @inode_order: Value of Options.inode_order.
+ * @largest_first: Value of Options.largest_first.
+ */
+typedef struct Setup {
+    const char *name;
+    int serial;
+    int inode_order;
+    int largest_first;
+} Setup;
+
+static const Setup setups[] = {
+    { "process_path",                0, 0, 0 },
+    { "process_path --inode-order",  0, 1, 0 },
+    { "process_path --largest-first", 0, 0, 1 },
+    { "walk_serial",                 1, 0, 0 },
+};
+
+/* ------------------ Declarations of internal functions ------------------ */
+
+static double scan(const Setup *setup, char *root, long *entries, blkcnt_t *blocks);
+static int drain(WorkerCtx *ctx);
+
+/* -------------------------- External functions -------------------------- */
+
+int main(int argc, char **argv)
+{
+    int n_dirs = argc > 1 && atoi(argv[1]) > 0 ? atoi(argv[1]) : DEFAULT_DIRS;
+    int passes = argc > 2 && atoi(argv[2]) > 0 ? atoi(argv[2]) : DEFAULT_PASSES;
+    int files[] = { 2, 64 };
+    int status = EXIT_SUCCESS;
+
+    char base[] = "/tmp/mdu-bench.XXXXXX";
+    if (!mkdtemp(base)) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+
+    printf("%-30s %6s %9s %12s\n", "setup", "files", "entries", "ns/entry");
+    for (size_t f = 0; f < sizeof(files) / sizeof(files[0]); f++) {
+        char root[PATH_MAX];
+        snprintf(root, sizeof(root), "%s/t%zu", base, f);
+        if (tree_make(root, f + 1, n_dirs, files[f]) != 0) {
+            status = EXIT_FAILURE;
+            break;
+        }
+        long expect = tree_total(root) - 8;
+
+        for (size_t s = 0; s < sizeof(setups) / sizeof(setups[0]); s++) {
+            double best = 0;
+            long entries = 0;
+            for (int p = 0; p <= passes; p++) {
+                blkcnt_t blocks = 0;
+                double t = scan(&setups[s], root, &entries, &blocks);
+                if (t < 0 || blocks != expect) {
+                    fprintf(stderr, "%s: got %ld blocks, expected %ld\n",
+                            setups[s].name, (long)blocks, expect);
+                    status = EXIT_FAILURE;
+                    break;
+                }
+                /* Pass 0 only warms the cache */
+                if (p == 1 || (p > 1 && t < best)) {
+                    best = t;
+                }
+            }
+            printf("%-30s %6d %9ld %12.0f\n", setups[s].name, files[f], entries,
+                   entries ? best * 1e9 / entries : 0);
+        }
+        tree_remove(root);
+    }
+    rmdir(base);
+    return status;
+}
+
+/* -------------------------- Internal functions -------------------------- */
+
+/**
+ * scan - Scans a tree once on the calling thread.
+ * @setup: How to scan it.
+ * @root: Tree to scan.
+ * @entries: Set to the number of entries stat'ed.
+ * @blocks: Set to the blocks counted, without the +8 mdu adds.
+ *
+ * Return: Elapsed seconds, or -1 on failure.
+ */
+static double scan(const Setup *setup, char *root, long *entries, blkcnt_t *blocks)
+{
+    Options opts = { 0 };
+    opts.n_threads = 1;
+    opts.inode_order = setup->inode_order;
+    opts.largest_first = setup->largest_first;
+
+    System system;
+    if (system_init(&system, &opts) != 0 || system_set_roots(&system, &root, 1) != 0) {
+        return -1;
+    }
+
+    Task *task = calloc(1, sizeof(Task));
+    Queue *children = create_queue();
+    TaskStack stack = { NULL, 0, 0 };
+    if (!task || !children) {
+        return -1;
+    }
+    strcpy(task->path, root);
+    task->sum = blocks;
+    task->dev = system.root_devs[0];
+    task->weight = 1.0;
+
+    WorkerCtx ctx = { .system = &system, .counters = &system.counters[0],
+                      .children = children, .stack = &stack };
+    int ret = 0;
+
+    double start = monotonic_seconds();
+    if (setup->serial) {
+        ret = stack_push(&stack, task) == 0 ? walk_serial(&ctx, &stack, 0) : -1;
+    } else {
+        ret = process_path(&ctx, task);
+        free(task);
+        if (ret == 0) {
+            ret = drain(&ctx);
+        }
+    }
+    double elapsed = monotonic_seconds() - start;
+
+    *entries = atomic_load(&system.counters[0].entries);
+    entry_buf_free(&ctx.entries);
+    free(stack.tasks);
+    free_queue(children);
+    system_destroy(&system);
+    return ret == 0 ? elapsed : -1;
+}
+
+/**
+ * drain - Processes queued tasks until the scheduler is empty.
+ * @ctx: Context of the calling thread.
+ *
+ * Return: 0 on success, otherwise -1.
+ */
+static int drain(WorkerCtx *ctx)
+{
+    System *system = ctx->system;
+    Queue *batch = create_queue();
+    int ret = batch ? 0 : -1;
+    int dev;
+
+    while (ret == 0) {
+        pthread_mutex_lock(system->lock);
+        int n = sched_take(system->sched, batch, &dev);
+        atomic_fetch_sub_explicit(&system->pending, n, memory_order_relaxed);
+        pthread_mutex_unlock(system->lock);
+        if (n == 0) {
+            break;
+        }
+
+        Task *task;
+        while ((task = dequeue(batch)) != NULL) {
+            if (process_path(ctx, task) != 0) {
+                ret = -1;
+            }
+            free(task);
+        }
+
+        pthread_mutex_lock(system->lock);
+        sched_done(system->sched, dev, 0, 0);
+        pthread_mutex_unlock(system->lock);
+    }
+    free_queue(batch);
+    return ret;
+}
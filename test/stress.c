@@ -0,0 +1,222 @@
+/**
+ * stress.c - Checks mdu's totals against a single-threaded reference walk.
+ *
+ * Builds random trees and runs the given mdu binary on each of them with
+ * a range of thread counts and scheduling options. Every reported total
+ * must match the nftw() reference and mdu must exit cleanly. Run with a
+ * ThreadSanitizer build of mdu (make test does), so a data race fails
+ * the run through its exit code even when the totals happen to match.
+ *
+ * Each tree is also saved as a snapshot and diffed against itself, which
+ * must report no changes.
+ *
+ * Usage: stress MDU [rounds]
+ *
+ * Author: Rasmus Mikaelsson (et24rmn)
+ * Version: 12-01-2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <linux/limits.h>
+
+#include "tree.h"
+
+/* Rounds run when none are given */
+#define DEFAULT_ROUNDS 4
+
+/* Options mdu is run with on every tree */
+static const char *const configs[] = {
+    "-j1",
+    "-j2",
+    "-j8",
+    "-j64",
+    "-j8 --inode-order",
+    "-j8 --largest-first",
+    "-j8 --max-queue-mem 1",
+    "-j16 --max-queue-mem 64K --largest-first",
+    "-j4 --procs 3",
+    "-j8 --by-user --by-group --histogram",
+    "-j8 --max-iops 1000000",
+    "-j8 --progress=0.001",
+};
+
+/* ------------------ Declarations of internal functions ------------------ */
+
+static int run_mdu(const char *mdu, const char *opts, const char *root, long expect);
+static int check_snapshot(const char *mdu, const char *base, const char *root, long expect);
+static void print_file(const char *path);
+
+/* -------------------------- External functions -------------------------- */
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s MDU [rounds]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    int rounds = argc > 2 && atoi(argv[2]) > 0 ? atoi(argv[2]) : DEFAULT_ROUNDS;
+    int n_configs = sizeof(configs) / sizeof(configs[0]);
+    int failed = 0;
+
+    char base[] = "/tmp/mdu-stress.XXXXXX";
+    if (!mkdtemp(base)) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+
+    for (int r = 0; r < rounds; r++) {
+        /* Every tree outlasts the serial pre-walk, so the pool always runs */
+        int n_dirs = (r % 3 == 0) ? 1000 : (r % 3 == 1) ? 3000 : 6000;
+        char root[PATH_MAX];
+        snprintf(root, sizeof(root), "%s/t%d", base, r);
+
+        if (tree_make(root, r + 1, n_dirs, 6) != 0) {
+            failed++;
+            break;
+        }
+        long expect = tree_total(root);
+        printf("tree %d: %d directories, %ld blocks\n", r, n_dirs, expect);
+
+        for (int c = 0; c < n_configs; c++) {
+            if (run_mdu(argv[1], configs[c], root, expect) != 0) {
+                failed++;
+            }
+        }
+        if (check_snapshot(argv[1], base, root, expect) != 0) {
+            failed++;
+        }
+        tree_remove(root);
+    }
+    rmdir(base);
+
+    if (failed) {
+        printf("%d check(s) failed\n", failed);
+        return EXIT_FAILURE;
+    }
+    printf("all checks passed\n");
+    return EXIT_SUCCESS;
+}
+
+/* -------------------------- Internal functions -------------------------- */
+
+/**
+ * run_mdu - Runs mdu on a tree given twice and checks both totals.
+ * @mdu: Path of the mdu binary.
+ * @opts: Options to run it with.
+ * @root: Tree to scan.
+ * @expect: Reference total of the tree.
+ *
+ * Return: 0 if mdu exited with 0 and reported @expect for both arguments,
+ *         otherwise -1.
+ */
+static int run_mdu(const char *mdu, const char *opts, const char *root, long expect)
+{
+    /* Progress lines and sanitizer reports are only shown on failure */
+    char err[PATH_MAX + 16];
+    char cmd[3 * PATH_MAX + 256];
+    snprintf(err, sizeof(err), "%s.err", root);
+    snprintf(cmd, sizeof(cmd), "%s %s %s %s 2>%s", mdu, opts, root, root, err);
+
+    FILE *out = popen(cmd, "r");
+    if (!out) {
+        perror("popen");
+        return -1;
+    }
+
+    /* Total lines end with the argument, breakdown lines with a name */
+    char line[PATH_MAX + 64];
+    char path[PATH_MAX + 64];
+    long totals[2];
+    long value;
+    int n = 0;
+    while (fgets(line, sizeof(line), out)) {
+        if (sscanf(line, "%ld %s", &value, path) == 2 && strcmp(path, root) == 0 && n < 2) {
+            totals[n++] = value;
+        }
+    }
+    int status = pclose(out);
+
+    int ok = status != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 0 &&
+             n == 2 && totals[0] == expect && totals[1] == expect;
+    printf("  %-4s %-45s", ok ? "ok" : "FAIL", opts);
+    if (!ok) {
+        printf(" exit %d, got %ld %ld", WIFEXITED(status) ? WEXITSTATUS(status) : -1,
+               n > 0 ? totals[0] : -1, n > 1 ? totals[1] : -1);
+    }
+    printf("\n");
+    if (!ok) {
+        print_file(err);
+    }
+    unlink(err);
+    return ok ? 0 : -1;
+}
+
+/**
+ * check_snapshot - Saves a snapshot of a tree and diffs the tree against it.
+ * @mdu: Path of the mdu binary.
+ * @base: Directory to keep the snapshot in.
+ * @root: Tree to scan.
+ * @expect: Reference total of the tree.
+ *
+ * Return: 0 if both runs succeeded and the diff listed no directory,
+ *         otherwise -1.
+ */
+static int check_snapshot(const char *mdu, const char *base, const char *root, long expect)
+{
+    char snap[PATH_MAX + 16];
+    char opts[2 * PATH_MAX];
+    snprintf(snap, sizeof(snap), "%s/snap", base);
+
+    snprintf(opts, sizeof(opts), "-j8 --save %s", snap);
+    if (run_mdu(mdu, opts, root, expect) != 0) {
+        return -1;
+    }
+
+    char cmd[3 * PATH_MAX];
+    snprintf(cmd, sizeof(cmd), "%s -j8 --largest-first --diff %s %s", mdu, snap, root);
+    FILE *out = popen(cmd, "r");
+    if (!out) {
+        perror("popen");
+        return -1;
+    }
+
+    /* Only the totals and the two headings may be printed */
+    char line[PATH_MAX + 64];
+    int rows = 0;
+    while (fgets(line, sizeof(line), out)) {
+        if (line[0] == '+' || line[0] == '-') {
+            rows++;
+        }
+    }
+    int status = pclose(out);
+    unlink(snap);
+
+    int ok = status != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 0 && rows == 0;
+    printf("  %-4s %-45s", ok ? "ok" : "FAIL", "--diff against own snapshot");
+    if (!ok) {
+        printf(" exit %d, %d changed directories", WIFEXITED(status) ? WEXITSTATUS(status) : -1, rows);
+    }
+    printf("\n");
+    return ok ? 0 : -1;
+}
+
+/**
+ * print_file - Copies a file to stdout.
+ * @path: File to print, skipped if it cannot be opened.
+ */
+static void print_file(const char *path)
+{
+    FILE *in = fopen(path, "r");
+    if (!in) {
+        return;
+    }
+    char line[PATH_MAX + 64];
+    while (fgets(line, sizeof(line), in)) {
+        fputs(line, stdout);
+    }
+    fclose(in);
+}
@@ -0,0 +1,208 @@
+/**
+ * tree.c - Random directory trees for the tests and benchmarks.
+ *
+ * Author: Rasmus Mikaelsson (et24rmn)
+ * Version: 12-01-2026
+ */
+
+/* nftw() is an XSI extension */
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <linux/limits.h>
+#include <sys/stat.h>
+
+#include "tree.h"
+
+/* Largest file written, in bytes */
+#define FILE_MAX 65536
+
+/* Descriptors nftw() may keep open */
+#define NFTW_FDS 64
+
+/* ------------------ Declarations of internal functions ------------------ */
+
+static unsigned random_next(unsigned *state);
+static int write_file(const char *path, size_t len);
+static int add_blocks(const char *path, const struct stat *sb, int flag, struct FTW *ftw);
+static int add_entry(const char *path, const struct stat *sb, int flag, struct FTW *ftw);
+static int remove_entry(const char *path, const struct stat *sb, int flag, struct FTW *ftw);
+
+/* nftw() callbacks take no user pointer */
+static long total;
+
+/* -------------------------- External functions -------------------------- */
+
+int tree_make(const char *root, unsigned seed, int n_dirs, int files)
+{
+    unsigned state = seed ? seed : 1;
+    char **dirs = calloc(n_dirs + 1, sizeof(char *));
+    char path[PATH_MAX];
+    int ret = -1;
+
+    if (!dirs) {
+        perror("calloc");
+        return -1;
+    }
+    if (mkdir(root, 0755) != 0 || !(dirs[0] = strdup(root))) {
+        perror(root);
+        free(dirs);
+        return -1;
+    }
+
+    for (int n = 1; n <= n_dirs; n++) {
+        /* Chains a third of the time, otherwise a random earlier parent */
+        const char *parent = random_next(&state) % 3 == 0 ? dirs[n - 1]
+                                                           : dirs[random_next(&state) % n];
+        if (snprintf(path, sizeof(path), "%s/d%d", parent, n) >= (int)sizeof(path)) {
+            parent = root;
+            snprintf(path, sizeof(path), "%s/d%d", parent, n);
+        }
+        if (mkdir(path, 0755) != 0 || !(dirs[n] = strdup(path))) {
+            perror(path);
+            goto out;
+        }
+
+        int n_files = files > 0 ? random_next(&state) % (files + 1) : 0;
+        for (int f = 0; f < n_files; f++) {
+            char file[PATH_MAX + 16];
+            snprintf(file, sizeof(file), "%s/f%d", path, f);
+            if (write_file(file, random_next(&state) % FILE_MAX) != 0) {
+                goto out;
+            }
+        }
+        if (random_next(&state) % 8 == 0) {
+            char link[PATH_MAX + 16];
+            snprintf(link, sizeof(link), "%s/l", path);
+            if (symlink(parent, link) != 0) {
+                perror(link);
+                goto out;
+            }
+        }
+    }
+    ret = 0;
+
+out:
+    for (int i = 0; i <= n_dirs; i++) {
+        free(dirs[i]);
+    }
+    free(dirs);
+    return ret;
+}
+
+long tree_total(const char *root)
+{
+    total = 8;
+    if (nftw(root, add_blocks, NFTW_FDS, FTW_PHYS) != 0) {
+        perror(root);
+        return -1;
+    }
+    return total;
+}
+
+long tree_entries(const char *root)
+{
+    total = 0;
+    if (nftw(root, add_entry, NFTW_FDS, FTW_PHYS) != 0) {
+        perror(root);
+        return -1;
+    }
+    return total;
+}
+
+int tree_remove(const char *root)
+{
+    if (nftw(root, remove_entry, NFTW_FDS, FTW_PHYS | FTW_DEPTH) != 0) {
+        perror(root);
+        return -1;
+    }
+    return 0;
+}
+
+/* -------------------------- Internal functions -------------------------- */
+
+/**
+ * random_next - Advances a xorshift32 generator.
+ * @state: Generator state, never 0.
+ *
+ * Return: Next pseudo-random number.
+ */
+static unsigned random_next(unsigned *state)
+{
+    unsigned x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+/**
+ * write_file - Creates a file filled with @len bytes.
+ * @path: Path of the file.
+ * @len: Size of the file.
+ *
+ * The data is written rather than truncated to so the file is not sparse
+ * and uses blocks.
+ *
+ * Return: 0 on success, -1 on failure.
+ */
+static int write_file(const char *path, size_t len)
+{
+    static const char buf[FILE_MAX];
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    if (write(fd, buf, len) != (ssize_t)len) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    return close(fd);
+}
+
+/**
+ * add_blocks - nftw() callback summing the blocks below the top directory.
+ */
+static int add_blocks(const char *path, const struct stat *sb, int flag, struct FTW *ftw)
+{
+    (void)path;
+    (void)flag;
+    if (ftw->level > 0) {
+        total += sb->st_blocks;
+    }
+    return 0;
+}
+
+/**
+ * add_entry - nftw() callback counting the entries below the top directory.
+ */
+static int add_entry(const char *path, const struct stat *sb, int flag, struct FTW *ftw)
+{
+    (void)path;
+    (void)sb;
+    (void)flag;
+    if (ftw->level > 0) {
+        total++;
+    }
+    return 0;
+}
+
+/**
+ * remove_entry - nftw() callback removing an entry after its children.
+ */
+static int remove_entry(const char *path, const struct stat *sb, int flag, struct FTW *ftw)
+{
+    (void)sb;
+    (void)ftw;
+    int ret = flag == FTW_DP ? rmdir(path) : unlink(path);
+    if (ret != 0) {
+        perror(path);
+    }
+    return ret;
+}
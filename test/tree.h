@@ -0,0 +1,56 @@
+/**
+ * tree.h - Random directory trees for the tests and benchmarks.
+ *
+ * Builds reproducible trees from a seed and computes their totals with
+ * a plain single-threaded nftw() walk, used as the reference that mdu's
+ * output is checked against.
+ *
+ * Author: Rasmus Mikaelsson (et24rmn)
+ * Version: 12-01-2026
+ */
+
+#ifndef TREE_H
+#define TREE_H
+
+/**
+ * tree_make - Creates a random tree.
+ * @root: Path of the tree's top directory, created by the call.
+ * @seed: Seed of the shape and file sizes.
+ * @n_dirs: Number of directories below @root.
+ * @files: Maximum number of files per directory.
+ *
+ * Every new directory goes either below the one created just before it,
+ * which grows deep chains, or below a random earlier one, which grows
+ * wide levels. Files get random sizes up to 64 KiB and some directories
+ * get a symbolic link.
+ *
+ * Return: 0 on success, -1 on failure.
+ */
+int tree_make(const char *root, unsigned seed, int n_dirs, int files);
+
+/**
+ * tree_total - Counts the blocks of a tree the way mdu reports them.
+ * @root: Path of the tree.
+ *
+ * Return: Blocks of every entry below @root plus 8 for @root itself,
+ *         or -1 on failure.
+ */
+long tree_total(const char *root);
+
+/**
+ * tree_entries - Counts the entries below the top of a tree.
+ * @root: Path of the tree.
+ *
+ * Return: Number of entries, or -1 on failure.
+ */
+long tree_entries(const char *root);
+
+/**
+ * tree_remove - Removes a tree.
+ * @root: Path of the tree.
+ *
+ * Return: 0 on success, -1 on failure.
+ */
+int tree_remove(const char *root);
+
+#endif
@@ -17,74 +17,352 @@
 #include <sys/stat.h>
 #include <dirent.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
 
 #include "worker.h"
 #include "system.h"
 #include "queue.h"
+#include "ratelimit.h"
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+/* Subdirectories collected before a large directory publishes them */
+#define BATCH_FLUSH 64
+
+/* Bounds for the adaptive spin before a worker parks on the condition */
+#define SPIN_MIN 64
+#define SPIN_MAX 16384
+
+/* Nested inline scans per worker under --max-queue-mem, each holds a DIR open */
+#define INLINE_DEPTH_MAX 16
+
+/* --largest-first: a subdirectory counts as this many entries, since it is a subtree of its own */
+#define SUBDIR_WEIGHT 32
+
+/* --largest-first: approximate bytes of directory size per entry */
+#define DIRENT_BYTES 32
+
+/* --largest-first: blocks per entry assumed before a worker has counted any */
+#define ENTRY_BLOCKS 8
 
 /* ------------------ Declarations of internal functions ------------------ */
 
+static inline int scan_dir(WorkerCtx *ctx, Task *task, const bool serial, Probe *probe);
+static inline int visit_entry(WorkerCtx *ctx, Task *task, const char *name, long *entries,
+                              blkcnt_t *blocks, int expired, const bool serial, Probe *probe);
+static inline double subtree_estimate(const struct stat *sb);
+static double subtree_priority(const WorkerCtx *ctx, const char *path, const struct stat *sb);
+static inline bool frontier_full(const WorkerCtx *ctx, const bool serial);
+static int scan_inline(WorkerCtx *ctx, Task *task, const bool serial);
+static void add_histograms(WorkerCtx *ctx, int root, const struct stat *sb);
+static inline int log2_bucket(int64_t value);
+static int read_entries(EntryBuf *buf, DIR *dir, DirEntry **sorted);
+static DirEntry *radix_sort(DirEntry *items, DirEntry *tmp, int n);
+static Task *make_task(const char *path, const Task *parent);
+static int process_probe(WorkerCtx *ctx, Task *task);
+static int probe_step(WorkerCtx *ctx, Task *task, blkcnt_t blocks, const Probe *probe);
+static int restart_probe(WorkerCtx *ctx, Task *task);
+static void add_counters(Counters *counters, long entries, blkcnt_t blocks);
+static void join_path(char *dst, const char *dir, const char *name);
+static uint64_t random_next(void);
 static int *fail_code(void);
 static int *critcal_fail_code(void);
 static int unlock_mutex(pthread_mutex_t *m);
 static int lock_mutex(pthread_mutex_t *m);
 static int wait_cond(pthread_cond_t *cond, pthread_mutex_t *lock);
+static int broadcast_cond(pthread_cond_t *cond);
+static int spin_for_work(System *system, int limit);
+static double clock_seconds(clockid_t clock);
+static inline void cpu_relax(void);
 
 /* -------------------------- External functions -------------------------- */
 
-int process_path(System *system, Task *task) {
-    blkcnt_t size = 0;
-    char path[PATH_MAX];
+int process_path(WorkerCtx *ctx, Task *task) {
+    if (ctx->system->opts->estimate) {
+        return process_probe(ctx, task);
+    }
+    int ret = scan_dir(ctx, task, false, NULL);
 
-    DIR *dir = opendir(task->path);
-    if (!dir) {
-        perror("opendir");
-        return -1;
+    /* Failures below the task surface once the whole subtree is done */
+    if (ctx->inline_failed) {
+        ctx->inline_failed = 0;
+        ret = -1;
     }
+    return ret;
+}
 
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+int walk_serial(WorkerCtx *ctx, TaskStack *stack, double budget) {
+    int status = 0;
+    double deadline = budget > 0 ? monotonic_seconds() + budget : 0;
+
+    while (stack->len > 0) {
+        /* Checked per directory, so one slow opendir cannot hold the pool back long */
+        if (deadline > 0 && monotonic_seconds() >= deadline) {
+            break;
+        }
+        Task *task = stack->tasks[--stack->len];
+
+        /* Past the deadline pending directories are dropped unread */
+        if(atomic_load_explicit(&ctx->system->expired, memory_order_relaxed)) {
+            free(task);
             continue;
         }
-        memcpy(path, task->path, strlen(task->path));
-        path[strlen(task->path)] = '/';
-        memcpy(path + strlen(task->path) + 1, entry->d_name, strlen(entry->d_name)+1);
-        struct stat sb;
-        if (lstat(path, &sb) == -1) {
-            perror("lstat");
-            if(closedir(dir) != 0) {
-                perror("closedir");
-            }
+
+        if(scan_dir(ctx, task, true, NULL) != 0 || ctx->inline_failed) {
+            ctx->inline_failed = 0;
+            status = -1;
+        }
+        free(task);
+    }
+    return status;
+}
+
+void entry_buf_free(EntryBuf *buf) {
+    free(buf->items);
+    free(buf->tmp);
+    free(buf->names);
+    *buf = (EntryBuf){ 0 };
+}
+
+int stack_push(TaskStack *stack, Task *task) {
+    if (stack->len == stack->cap) {
+        int cap = stack->cap ? stack->cap * 2 : 64;
+        Task **tasks = realloc(stack->tasks, cap * sizeof(Task *));
+        if (!tasks) {
+            perror("realloc");
             return -1;
         }
-        size += sb.st_blocks;
+        stack->tasks = tasks;
+        stack->cap = cap;
+    }
+    stack->tasks[stack->len++] = task;
+    return 0;
+}
 
-        if (S_ISDIR(sb.st_mode)) {
-            Task *child_task = malloc(sizeof(Task));
-            if(!child_task) {
-                perror("malloc");
-                return -1;
+void *worker(void *args) {
+    System *system = (System *)args;
+    int status = 0;
+    int spin_limit = SPIN_MIN;
+    int id = atomic_fetch_add(&system->next_id, 1);
+
+    /* Private queues for taken tasks and for discovered subdirectories */
+    Queue *batch = create_queue();
+    Queue *children = create_queue();
+    if(!batch || !children) {
+        free_queue(batch);
+        free_queue(children);
+        return critcal_fail_code();
+    }
+    WorkerCtx ctx = { .system = system, .counters = &system->counters[id], .children = children,
+                      .users = system->users ? &system->users[id] : NULL,
+                      .groups = system->groups ? &system->groups[id] : NULL,
+                      .hist = system->hist ? system->hist + id * system->hist_stride : NULL,
+                      .dirlog = system->dirlogs ? &system->dirlogs[id] : NULL };
+
+    /* Device of the last batch and how long it took, reported to the scheduler */
+    int dev = -1;
+    double wall = 0, cpu = 0;
+
+    /* Wait until queue has tasks or system is done */
+    while (1) {
+        /* Short gaps between tasks are cheaper to spin through than to park */
+        if(system->spin) {
+            spin_limit = spin_for_work(system, spin_limit);
+        }
+
+        if(lock_mutex(system->lock) != 0) {
+            break;
+        }
+
+        if(dev >= 0) {
+            sched_done(system->sched, dev, wall, cpu);
+            dev = -1;
+            system->busy--;
+
+            /* The last busy worker finding no work ends the scan */
+            if(system->busy == 0 && sched_size(system->sched) == 0 &&
+               broadcast_cond(system->cond) != 0) {
+                status = -2;
+                break;
             }
+        }
 
-            child_task->sum = task->sum;
-            strncpy(child_task->path, path, PATH_MAX);
-            if(system_enqueue(system, child_task) != 0) {
-                free(child_task);
-                if(closedir(dir) != 0) {
-                    perror("closedir");
-                }
-                return -1;
+        /* An empty queue is only final once no busy worker can refill it */
+        while (sched_size(system->sched) == 0 && !(*(system->done) == 1 && system->busy == 0)) {
+            system->idle++;
+            if(wait_cond(system->cond, system->lock) != 0) {
+                status = -2;
+                break;
+            }
+            system->idle--;
+        }
+        if(status == -2) {
+            break;
+        }
+
+        /* Exit if done, the queue is empty and no worker can add to it */
+        if (sched_size(system->sched) == 0) {
+            if(unlock_mutex(system->lock) != 0) {
+                break;
+            }
+            free_queue(batch);
+            free_queue(children);
+            entry_buf_free(&ctx.entries);
+            return status == 0 ? NULL : fail_code();
+        }
+
+        /* Take a batch from the next device that has a free slot */
+        int n = sched_take(system->sched, batch, &dev);
+        atomic_fetch_sub_explicit(&system->pending, n, memory_order_relaxed);
+        system->busy++;
+        if(unlock_mutex(system->lock) != 0) {
+            break;
+        }
+
+        double wall_start = clock_seconds(CLOCK_MONOTONIC);
+        double cpu_start = clock_seconds(CLOCK_THREAD_CPUTIME_ID);
+        int64_t slept_start = ratelimit_slept_ns();
+
+        Task *task;
+        while ((task = dequeue(batch)) != NULL) {
+            /* Past the deadline queued directories are dropped unread */
+            if(atomic_load_explicit(&system->expired, memory_order_relaxed)) {
+                free(task);
+                continue;
+            }
+
+            /* Process task: sum file blocks or enqueue directories */
+            if(process_path(&ctx, task) != 0) {
+                status = -1;
+            }
+
+            /* Free task memory */
+            free(task);
+        }
+
+        /* Waiting on --max-iops is not device latency */
+        wall = clock_seconds(CLOCK_MONOTONIC) - wall_start -
+               (ratelimit_slept_ns() - slept_start) / 1e9;
+        cpu = clock_seconds(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+    }
+
+    free_queue(batch);
+    free_queue(children);
+    entry_buf_free(&ctx.entries);
+    return critcal_fail_code();
+}
+
+/* -------------------------- Internal functions -------------------------- */
+
+/**
+ * scan_dir - Sums the blocks of a directory's entries and emits its subdirectories.
+ * @ctx: Calling worker.
+ * @task: Directory to scan.
+ * @serial: True when called from walk_serial() on a thread that owns all state.
+ * @probe: Reservoir of an --estimate probe, NULL for a full scan.
+ *
+ * Shared by the pool, the single-threaded engine and --estimate. It is
+ * always inlined with a constant @serial and @probe, so the serial copy
+ * has no locking, no queue nodes and no wakeups: subdirectories go
+ * straight onto ctx->stack and the sum is updated in place. A probe
+ * emits no subdirectories and hands the directory to probe_step().
+ *
+ * Return: 0 on success, otherwise -1
+ */
+static inline __attribute__((always_inline)) int scan_dir(WorkerCtx *ctx, Task *task, const bool serial,
+                                                          Probe *probe) {
+    System *system = ctx->system;
+    Queue *children = ctx->children;
+
+    /* Past the deadline only directories already being read are finished */
+    int expired = atomic_load_explicit(&system->expired, memory_order_relaxed);
+    long entries = 0;
+    blkcnt_t blocks = 0;
+    int ret = 0;
+
+    /* Reading a directory costs one I/O on top of the stats of its entries */
+    ratelimit_acquire(system->dirs, &ctx->dir_tokens);
+    ratelimit_acquire(system->iops, &ctx->iops_tokens);
+    DIR *dir = opendir(task->path);
+    if (!dir) {
+        perror("opendir");
+
+        /* An unreadable argument would fail every probe the same way */
+        if (probe && strcmp(task->path, system->roots[task->root]) != 0) {
+            restart_probe(ctx, task);
+        }
+        return -1;
+    }
+
+    /* The record id must exist before any subdirectory points to it */
+    if (ctx->dirlog && dirlog_add(ctx->dirlog, task->path, task->parent, task->depth, &task->rec) != 0) {
+        closedir(dir);
+        return -1;
+    }
+
+    if (system->opts->inode_order) {
+        /* Read all names first, then stat them in inode table order */
+        DirEntry *sorted = NULL;
+        int n = read_entries(&ctx->entries, dir, &sorted);
+        if(closedir(dir) != 0 ) {
+            perror("closedir");
+            ret = -1;
+        }
+        if (n < 0) {
+            ret = -1;
+        }
+        for (int i = 0; i < n && ret == 0; i++) {
+            const char *name = ctx->entries.names + sorted[i].name;
+            ret = visit_entry(ctx, task, name, &entries, &blocks, expired, serial, probe);
+        }
+    } else {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+                continue;
+            }
+            ret = visit_entry(ctx, task, entry->d_name, &entries, &blocks, expired, serial, probe);
+            if (ret != 0) {
+                break;
             }
         }
+        if(closedir(dir) != 0 ) {
+            perror("closedir");
+            ret = -1;
+        }
+    }
+
+    add_counters(ctx->counters, entries, blocks);
+
+    /* A probe goes on with what it read, even after an error */
+    if(probe) {
+        return probe_step(ctx, task, blocks, probe) != 0 ? -1 : ret;
+    }
 
+    if(serial) {
+        /* Same rule as the pool: a failed directory adds nothing */
+        if(ret != 0) {
+            return ret;
+        }
+        *(task->sum) += blocks;
+        if(ctx->dirlog) {
+            dirlog_set(ctx->dirlog, task->rec, blocks);
+        }
+        return ret;
     }
-    if(closedir(dir) != 0 ) {
-        perror("closedir");
+
+    /* Subdirectories found before an error are still counted */
+    if(system_enqueue_batch(system, children) != 0) {
         return -1;
     }
+    if(ret != 0) {
+        return ret;
+    }
+    if(ctx->dirlog) {
+        dirlog_set(ctx->dirlog, task->rec, blocks);
+    }
     
     /* Lock mutex */
 	if(lock_mutex(system->lock) != 0) {
@@ -92,7 +370,7 @@ int process_path(System *system, Task *task) {
 	}
 
     /* Update sum */
-    *(task->sum) += size;
+    *(task->sum) += blocks;
 	
     /* Unlock mutex */
     if(unlock_mutex(system->lock) != 0) {
@@ -101,46 +379,482 @@ int process_path(System *system, Task *task) {
 	return 0;
 }
 
-void *worker(void *args) {
-    System *system = (System *)args;
-    int status = 0;
+/**
+ * process_probe - Takes one step of a random descent (Knuth's estimator).
+ * @ctx: Calling worker.
+ * @task: Current directory of the probe.
+ *
+ * Every directory on the path is weighted by the product of the branching
+ * factors above it, so the probe total is an unbiased estimate of the
+ * blocks under the argument. The probe continues into one uniformly chosen
+ * subdirectory, picked by reservoir sampling during readdir, and a new
+ * probe is started from the argument when it reaches a leaf.
+ *
+ * Return: 0 on success, otherwise -1
+ */
+static int process_probe(WorkerCtx *ctx, Task *task) {
+    Probe probe = { .n_dirs = 0 };
+    return scan_dir(ctx, task, false, &probe);
+}
 
-    /* Wait until queue has tasks or system is done */
-    while (1) {
-        if(lock_mutex(system->lock) != 0) {
-            return critcal_fail_code();
+/**
+ * probe_step - Adds a scanned directory to its probe and continues the descent.
+ * @ctx: Calling worker.
+ * @task: Directory the probe just scanned.
+ * @blocks: Blocks counted in the directory.
+ * @probe: Subdirectory picked while scanning.
+ *
+ * Return: 0 on success, otherwise -1
+ */
+static int probe_step(WorkerCtx *ctx, Task *task, blkcnt_t blocks, const Probe *probe) {
+    task->estimate += task->weight * blocks;
+    if (probe->n_dirs == 0) {
+        return restart_probe(ctx, task) != 0 ? -1 : 0;
+    }
+
+    Task *child_task = make_task(probe->path, task);
+    if(!child_task) {
+        return -1;
+    }
+    child_task->dev = probe->dev;
+    child_task->weight = task->weight * probe->n_dirs;
+    child_task->estimate = task->estimate;
+    if(enqueue(ctx->children, child_task) != 0 || system_enqueue_batch(ctx->system, ctx->children) != 0) {
+        free(child_task);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * restart_probe - Ends a probe and starts a new one from its argument if allowed.
+ * @ctx: Calling worker.
+ * @task: Last task of the finished probe.
+ *
+ * Return: 0 on success, otherwise -1
+ */
+static int restart_probe(WorkerCtx *ctx, Task *task) {
+    System *system = ctx->system;
+    Queue *children = ctx->children;
+    int again = system_probe_done(system, task);
+    if (again <= 0) {
+        return again;
+    }
+
+    Task *probe = make_task(system->roots[task->root], task);
+    if(!probe) {
+        return -1;
+    }
+    probe->dev = system->root_devs[task->root];
+    if(enqueue(children, probe) != 0 || system_enqueue_batch(system, children) != 0) {
+        free(probe);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * add_counters - Publishes the statistics of one directory to the live counters.
+ * @counters: Counters of the calling worker.
+ * @entries: Entries stat'ed in the directory.
+ * @blocks: Blocks counted in the directory.
+ *
+ * The worker is the only writer, so a relaxed load and store is enough
+ * and avoids a locked read-modify-write.
+ */
+static void add_counters(Counters *counters, long entries, blkcnt_t blocks) {
+    atomic_store_explicit(&counters->entries,
+        atomic_load_explicit(&counters->entries, memory_order_relaxed) + entries, memory_order_relaxed);
+    atomic_store_explicit(&counters->dirs,
+        atomic_load_explicit(&counters->dirs, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_store_explicit(&counters->blocks,
+        atomic_load_explicit(&counters->blocks, memory_order_relaxed) + blocks, memory_order_relaxed);
+}
+
+/**
+ * visit_entry - Stats one directory entry, counts it and emits it if it is a directory.
+ * @ctx: Calling worker.
+ * @task: Directory being scanned.
+ * @name: Entry name within @task->path.
+ * @entries: Entry count of the directory, updated.
+ * @blocks: Block count of the directory, updated.
+ * @expired: Non-zero if the deadline has passed and no subdirectory may be emitted.
+ * @serial: Same as for scan_dir().
+ * @probe: Same as for scan_dir(); a subdirectory only enters its reservoir.
+ *
+ * Return: 0 on success, otherwise -1
+ */
+static inline __attribute__((always_inline)) int visit_entry(WorkerCtx *ctx, Task *task, const char *name,
+                                                             long *entries, blkcnt_t *blocks, int expired,
+                                                             const bool serial, Probe *probe) {
+    System *system = ctx->system;
+    Queue *children = ctx->children;
+    char path[PATH_MAX];
+
+    join_path(path, task->path, name);
+    struct stat sb;
+    ratelimit_acquire(system->iops, &ctx->iops_tokens);
+    if (lstat(path, &sb) == -1) {
+        perror("lstat");
+        return -1;
+    }
+    (*entries)++;
+    *blocks += sb.st_blocks;
+
+    if (ctx->users && idmap_add(ctx->users, task->root, sb.st_uid, sb.st_blocks) != 0) {
+        return -1;
+    }
+    if (ctx->groups && idmap_add(ctx->groups, task->root, sb.st_gid, sb.st_blocks) != 0) {
+        return -1;
+    }
+    if (ctx->hist && S_ISREG(sb.st_mode)) {
+        add_histograms(ctx, task->root, &sb);
+    }
+
+    /* Each subdirectory replaces the pick with probability 1/n_dirs */
+    if (probe) {
+        if (S_ISDIR(sb.st_mode) && random_next() % ++probe->n_dirs == 0) {
+            strlcpy(probe->path, path, PATH_MAX);
+            probe->dev = sb.st_dev;
         }
+        return 0;
+    }
 
-        while (is_empty(system->queue) && *(system->done) == 0) {
-            if(wait_cond(system->cond, system->lock) != 0) {
-                return critcal_fail_code();
-            }
+    if (!S_ISDIR(sb.st_mode) || expired) {
+        return 0;
+    }
+
+    Task *child_task = make_task(path, task);
+    if(!child_task) {
+        return -1;
+    }
+    child_task->dev = sb.st_dev;
+    if(system->opts->largest_first) {
+        child_task->priority = subtree_priority(ctx, path, &sb);
+    }
+
+    /* A full frontier is drained depth-first by the worker that finds more */
+    if(child_task->dev == task->dev && frontier_full(ctx, serial)) {
+        int ret = scan_inline(ctx, child_task, serial);
+        free(child_task);
+        return ret;
+    }
+
+    if(serial) {
+        if(stack_push(ctx->stack, child_task) != 0) {
+            free(child_task);
+            return -1;
         }
+        return 0;
+    }
 
-        /* Exit if done and queue is empty */
-        if (*(system->done) == 1 && is_empty(system->queue)) {
-            if(unlock_mutex(system->lock) != 0) {
-                return critcal_fail_code();
+    /* A mount point goes to the queue of its own device */
+    if(child_task->dev != task->dev) {
+        if(system_enqueue(system, child_task) != 0) {
+            free(child_task);
+            return -1;
+        }
+        return 0;
+    }
+
+    if(enqueue(children, child_task) != 0) {
+        free(child_task);
+        return -1;
+    }
+
+    /* Publish large directories in chunks so idle workers get fed */
+    if(size(children) >= BATCH_FLUSH && system_enqueue_batch(system, children) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * subtree_estimate - Guesses the size of a subtree from its top directory alone.
+ * @sb: Status of the directory.
+ *
+ * On most file systems a directory's link count is two plus its number of
+ * subdirectories, and its size grows with its number of entries. Where
+ * the link count is not kept (btrfs reports 1) only the size is used.
+ *
+ * Return: Estimated size in entries.
+ */
+static inline double subtree_estimate(const struct stat *sb) {
+    double subdirs = sb->st_nlink > 2 ? (double)(sb->st_nlink - 2) : 0.0;
+    return subdirs * SUBDIR_WEIGHT + (double)sb->st_size / DIRENT_BYTES;
+}
+
+/**
+ * subtree_priority - Scheduling key of a subdirectory under --largest-first.
+ * @ctx: Calling worker.
+ * @path: Path of the subdirectory.
+ * @sb: Status of the subdirectory.
+ *
+ * The total from the --diff snapshot is the best guess when there is one.
+ * Directories it does not know fall back to subtree_estimate(), turned
+ * into blocks with the average the worker has counted so far, so both
+ * kinds of keys compare in the same unit.
+ *
+ * Return: Estimated blocks under the subdirectory.
+ */
+static double subtree_priority(const WorkerCtx *ctx, const char *path, const struct stat *sb) {
+    if (ctx->system->prior) {
+        int64_t blocks = snapshot_lookup(ctx->system->prior, path);
+        if (blocks >= 0) {
+            return (double)blocks;
+        }
+    }
+    long entries = atomic_load_explicit(&ctx->counters->entries, memory_order_relaxed);
+    long blocks = atomic_load_explicit(&ctx->counters->blocks, memory_order_relaxed);
+    double per_entry = entries > 0 ? (double)blocks / entries : ENTRY_BLOCKS;
+    return subtree_estimate(sb) * per_entry;
+}
+
+/**
+ * frontier_full - Tells whether the queued directories have reached --max-queue-mem.
+ * @ctx: Calling worker.
+ * @serial: Same as for scan_dir().
+ *
+ * Counts the shared queues plus the tasks the worker has not yet
+ * published. Beyond INLINE_DEPTH_MAX nested inline scans the frontier is
+ * reported as not full, so the open directories of one worker stay
+ * bounded and the cap is exceeded instead.
+ *
+ * Return: True if the next subdirectory should be scanned inline.
+ */
+static inline bool frontier_full(const WorkerCtx *ctx, const bool serial) {
+    long cap = ctx->system->frontier_cap;
+    if (cap == 0 || ctx->inline_depth >= INLINE_DEPTH_MAX) {
+        return false;
+    }
+    if (serial) {
+        return ctx->stack->len >= cap;
+    }
+    return atomic_load_explicit(&ctx->system->pending, memory_order_relaxed) + size(ctx->children) >= cap;
+}
+
+/**
+ * scan_inline - Scans a subdirectory right away instead of queueing it.
+ * @ctx: Calling worker.
+ * @task: Subdirectory to scan, owned by the caller.
+ * @serial: Same as for scan_dir().
+ *
+ * The parent may still be iterating the --inode-order buffers, so the
+ * nested scan gets its own. A failure is recorded in ctx->inline_failed
+ * rather than returned, so the parent keeps counting its other entries.
+ *
+ * Return: Always 0.
+ */
+static int scan_inline(WorkerCtx *ctx, Task *task, const bool serial) {
+    EntryBuf saved = ctx->entries;
+    ctx->entries = (EntryBuf){ 0 };
+    ctx->inline_depth++;
+
+    int ret = serial ? scan_dir(ctx, task, true, NULL) : scan_dir(ctx, task, false, NULL);
+
+    ctx->inline_depth--;
+    entry_buf_free(&ctx->entries);
+    ctx->entries = saved;
+    if (ret != 0) {
+        ctx->inline_failed = 1;
+    }
+    return 0;
+}
+
+/**
+ * add_histograms - Counts a regular file in the requested histograms.
+ * @ctx: Calling worker.
+ * @root: Index of the argument the file belongs to.
+ * @sb: Status of the file.
+ */
+static void add_histograms(WorkerCtx *ctx, int root, const struct stat *sb) {
+    const System *system = ctx->system;
+    int kinds = system->opts->histogram;
+    HistBucket *hist = ctx->hist + (size_t)root * HIST_KINDS * HIST_BUCKETS;
+    int64_t values[HIST_KINDS] = {
+        [HIST_SIZE] = sb->st_size,
+        [HIST_ATIME] = system->hist_now - sb->st_atime,
+        [HIST_MTIME] = system->hist_now - sb->st_mtime,
+    };
+
+    for (int k = 0; k < HIST_KINDS; k++) {
+        if (kinds & (1 << k)) {
+            HistBucket *bucket = &hist[k * HIST_BUCKETS + log2_bucket(values[k])];
+            bucket->count++;
+            bucket->blocks += sb->st_blocks;
+        }
+    }
+}
+
+/**
+ * log2_bucket - Histogram bucket of a value.
+ * @value: Size in bytes or age in seconds; negative ages count as 0.
+ *
+ * Return: 0 for values below 1, otherwise k such that 2^(k-1) <= value < 2^k.
+ */
+static inline int log2_bucket(int64_t value) {
+    if (value <= 0) {
+        return 0;
+    }
+    return 64 - __builtin_clzll((uint64_t)value);
+}
+
+/**
+ * read_entries - Reads all entry names of a directory and sorts them by inode.
+ * @buf: Reusable buffer of the calling worker.
+ * @dir: Open directory stream.
+ * @sorted: Set to the entries in ascending inode order.
+ *
+ * On ext4 and XFS inode numbers follow the layout of the inode tables, so
+ * stat'ing in this order turns random table reads into near-sequential
+ * ones on a cold cache.
+ *
+ * Return: Number of entries, or -1 on failure.
+ */
+static int read_entries(EntryBuf *buf, DIR *dir, DirEntry **sorted) {
+    int n = 0;
+    size_t used = 0;
+    struct dirent *entry;
+
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+
+        size_t len = strlen(entry->d_name) + 1;
+        if (n == buf->cap) {
+            int cap = buf->cap ? buf->cap * 2 : 256;
+            DirEntry *items = realloc(buf->items, cap * sizeof(DirEntry));
+            if (!items) {
+                perror("realloc");
+                return -1;
             }
-            return status == 0 ? NULL : fail_code();
+            buf->items = items;
+            DirEntry *tmp = realloc(buf->tmp, cap * sizeof(DirEntry));
+            if (!tmp) {
+                perror("realloc");
+                return -1;
+            }
+            buf->tmp = tmp;
+            buf->cap = cap;
+        }
+        if (used + len > buf->names_cap) {
+            size_t cap = MAX(buf->names_cap * 2, used + len + 4096);
+            char *names = realloc(buf->names, cap);
+            if (!names) {
+                perror("realloc");
+                return -1;
+            }
+            buf->names = names;
+            buf->names_cap = cap;
         }
 
-        Task *task = dequeue(system->queue);
-        if(unlock_mutex(system->lock) != 0) {
-            return critcal_fail_code();
+        memcpy(buf->names + used, entry->d_name, len);
+        buf->items[n].ino = entry->d_ino;
+        buf->items[n].name = used;
+        used += len;
+        n++;
+    }
+
+    *sorted = radix_sort(buf->items, buf->tmp, n);
+    return n;
+}
+
+/**
+ * radix_sort - LSD radix sort of directory entries by inode number.
+ * @items: Entries to sort.
+ * @tmp: Scratch array of the same size.
+ * @n: Number of entries.
+ *
+ * Byte positions where every key has the same value are skipped, so
+ * the usual small inode ranges of one directory take only a few passes.
+ *
+ * Return: @items or @tmp, whichever holds the sorted result.
+ */
+static DirEntry *radix_sort(DirEntry *items, DirEntry *tmp, int n) {
+    for (int shift = 0; shift < 64; shift += 8) {
+        int count[256] = { 0 };
+        for (int i = 0; i < n; i++) {
+            count[(items[i].ino >> shift) & 0xff]++;
+        }
+        if (n == 0 || count[(items[0].ino >> shift) & 0xff] == n) {
+            continue;
         }
 
-        /* Process task: sum file blocks or enqueue directories */
-        if(process_path(system, task) != 0) {
-            status = -1;
+        int pos = 0;
+        for (int b = 0; b < 256; b++) {
+            int c = count[b];
+            count[b] = pos;
+            pos += c;
+        }
+        for (int i = 0; i < n; i++) {
+            tmp[count[(items[i].ino >> shift) & 0xff]++] = items[i];
         }
 
-        /* Free task memory */
-        free(task);
+        DirEntry *swap = items;
+        items = tmp;
+        tmp = swap;
     }
+    return items;
 }
 
-/* -------------------------- Internal functions -------------------------- */
+/**
+ * make_task - Allocates a task for a subdirectory of @parent's argument.
+ * @path: Path of the directory.
+ * @parent: Task the directory was found from.
+ *
+ * Only the used part of the path buffer is written.
+ *
+ * Return: New task, or NULL on failure.
+ */
+static Task *make_task(const char *path, const Task *parent) {
+    Task *task = malloc(sizeof(Task));
+    if(!task) {
+        perror("malloc");
+        return NULL;
+    }
+
+    memcpy(task->path, path, strlen(path) + 1);
+    task->sum = parent->sum;
+    task->root = parent->root;
+    task->dev = parent->dev;
+    task->weight = 1.0;
+    task->estimate = 0.0;
+    task->priority = 0.0;
+    task->rec = SNAP_NONE;
+    task->parent = parent->rec;
+    task->depth = parent->depth + 1;
+    return task;
+}
+
+/**
+ * join_path - Writes "dir/name" to dst.
+ * @dst: Buffer of PATH_MAX bytes.
+ * @dir: Directory path.
+ * @name: Entry name within @dir.
+ */
+static void join_path(char *dst, const char *dir, const char *name) {
+    size_t len = strlen(dir);
+    memcpy(dst, dir, len);
+    dst[len] = '/';
+    memcpy(dst + len + 1, name, strlen(name) + 1);
+}
+
+/**
+ * random_next - Per-thread xorshift64* pseudo random number generator.
+ *
+ * Return: Next pseudo random number of the calling thread.
+ */
+static uint64_t random_next(void) {
+    static __thread uint64_t state;
+    if (state == 0) {
+        state = (uint64_t)time(NULL) ^ (uint64_t)pthread_self() ^ 0x9e3779b97f4a7c15ULL;
+    }
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545f4914f6cdd1dULL;
+}
 
 /**
  * fail_code - Allocates and returns a non-critical failure code.
@@ -211,3 +925,63 @@ static int wait_cond(pthread_cond_t *cond, pthread_mutex_t *lock) {
     }
     return 0;
 }
+
+/**
+ * broadcast_cond - Wakes every thread waiting on a condition variable.
+ * @cond: Pointer to the condition variable.
+ *
+ * Return: 0 on success, -1 on failure.
+ */
+static int broadcast_cond(pthread_cond_t *cond) {
+    int ret = pthread_cond_broadcast(cond);
+    if (ret != 0) {
+        fprintf(stderr, "pthread_cond_broadcast failed: %s\n", strerror(ret));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * spin_for_work - Spins on the pending hint for at most @limit iterations.
+ * @system: Pointer to the system structure.
+ * @limit: Current spin budget of the calling worker.
+ *
+ * The budget adapts like an adaptive mutex: it doubles when work showed
+ * up while spinning and halves when the worker ended up parking anyway.
+ *
+ * Return: Spin budget to use on the next call.
+ */
+static int spin_for_work(System *system, int limit) {
+    for (int i = 0; i < limit; i++) {
+        if (atomic_load_explicit(&system->pending, memory_order_relaxed) > 0) {
+            return MIN(limit * 2, SPIN_MAX);
+        }
+        cpu_relax();
+    }
+    return MAX(limit / 2, SPIN_MIN);
+}
+
+/**
+ * clock_seconds - Reads a clock in seconds.
+ * @clock: Clock to read.
+ *
+ * Return: Value of @clock in seconds.
+ */
+static double clock_seconds(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * cpu_relax - Hints the CPU that the caller is busy-waiting.
+ */
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+}
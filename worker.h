@@ -10,16 +10,127 @@
 #ifndef WORKER_H
 #define WORKER_H
 
+#include <stdint.h>
 #include "system.h"
 
+/**
+ * struct DirEntry - Directory entry waiting to be stat'ed in inode order.
+ * @ino: Inode number from readdir.
+ * @name: Offset of the entry name in EntryBuf.names.
+ */
+typedef struct DirEntry {
+    uint64_t ino;
+    size_t name;
+} DirEntry;
+
+/**
+ * struct EntryBuf - Per-worker buffers reused for every directory in inode order mode.
+ * @items: Entries in readdir order.
+ * @tmp: Scratch array for the radix sort.
+ * @cap: Capacity of @items and @tmp.
+ * @names: Packed, NUL-terminated entry names.
+ * @names_cap: Capacity of @names in bytes.
+ */
+typedef struct EntryBuf {
+    DirEntry *items;
+    DirEntry *tmp;
+    int cap;
+    char *names;
+    size_t names_cap;
+} EntryBuf;
+
+/**
+ * struct TaskStack - Growable array of tasks used by the single-threaded engine.
+ * @tasks: Pending tasks, the last one is processed next.
+ * @len: Number of pending tasks.
+ * @cap: Allocated capacity of @tasks.
+ */
+typedef struct TaskStack {
+    Task **tasks;
+    int len;
+    int cap;
+} TaskStack;
+
+/**
+ * struct Probe - Reservoir sample of one subdirectory for an --estimate probe.
+ * @n_dirs: Subdirectories seen so far.
+ * @path: Path of the subdirectory picked so far.
+ * @dev: Device of the subdirectory picked so far.
+ */
+typedef struct Probe {
+    long n_dirs;
+    char path[PATH_MAX];
+    dev_t dev;
+} Probe;
+
+/**
+ * struct WorkerCtx - Private state of one worker thread.
+ * @system: Pointer to the shared System struct.
+ * @counters: Live statistics of this worker.
+ * @children: Scratch queue used to batch subdirectory tasks.
+ * @stack: Pending tasks of the single-threaded engine, NULL in the pool.
+ * @entries: Reusable buffers for --inode-order.
+ * @users: This worker's usage by owner, NULL if not requested.
+ * @groups: This worker's usage by group, NULL if not requested.
+ * @hist: This worker's histograms, NULL if not requested.
+ * @dirlog: This worker's directory records, NULL if not requested.
+ * @iops_tokens: Tokens fetched from system->iops and not yet spent.
+ * @dir_tokens: Tokens fetched from system->dirs and not yet spent.
+ * @inline_depth: Directories being scanned inline below the current task.
+ * @inline_failed: Set if a directory scanned inline failed.
+ */
+typedef struct WorkerCtx {
+    System *system;
+    Counters *counters;
+    Queue *children;
+    TaskStack *stack;
+    EntryBuf entries;
+    IdMap *users;
+    IdMap *groups;
+    HistBucket *hist;
+    DirLog *dirlog;
+    int iops_tokens;
+    int dir_tokens;
+    int inline_depth;
+    int inline_failed;
+} WorkerCtx;
+
 /**
  * process_path - Handles path: adds file blocks or explores directory.
- * @system: Pointer to System struct.
+ * @ctx: Calling worker.
  * @path: Path to process.
  * 
  * @return 0 on success, otherwise -1
  */
-int process_path(System *system, Task *path);
+int process_path(WorkerCtx *ctx, Task *path);
+
+/**
+ * walk_serial - Walks a tree depth-first on the calling thread without synchronization.
+ * @ctx: Context of the calling thread, with @ctx->stack set.
+ * @stack: Tasks to process; subdirectories are pushed back onto it.
+ * @budget: Seconds to walk before returning, 0 for no limit.
+ *
+ * Must only run while no worker thread is started. Tasks left on @stack
+ * when the budget runs out can be handed to the pool.
+ *
+ * @return 0 on success, otherwise -1
+ */
+int walk_serial(WorkerCtx *ctx, TaskStack *stack, double budget);
+
+/**
+ * entry_buf_free - Frees the buffers of an EntryBuf and resets it.
+ * @buf: Buffer to free.
+ */
+void entry_buf_free(EntryBuf *buf);
+
+/**
+ * stack_push - Pushes a task onto a TaskStack.
+ * @stack: Stack to push onto.
+ * @task: Task to push.
+ *
+ * @return 0 on success, otherwise -1
+ */
+int stack_push(TaskStack *stack, Task *task);
 
 /**
  * worker - Worker thread routine that processes queued tasks until termination.